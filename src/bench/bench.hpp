@@ -0,0 +1,27 @@
+#ifndef QCC_BENCH_HPP
+#define QCC_BENCH_HPP
+
+#include "common.hpp"
+#include <chrono>
+
+namespace qcc
+{
+
+// Best wall time over a few runs, in milliseconds
+inline float64 bench_time(auto &&function, size_t runs = 5)
+{
+    float64 best = 0.0;
+
+    for (size_t n = 0; n < runs; n++) {
+        auto begin = std::chrono::steady_clock::now();
+        function();
+        std::chrono::duration<float64, std::milli> time = std::chrono::steady_clock::now() - begin;
+        best = n == 0 ? time.count() : Min(best, time.count());
+    }
+
+    return best;
+}
+
+} // namespace qcc
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef QCC_MACRO_BENCH_HPP
+#define QCC_MACRO_BENCH_HPP
+
+#include "bench.hpp"
+#include "preprocess.hpp"
+#include <fstream>
+
+namespace qcc
+{
+
+// X-macro table of the given entries, expanded twice through nested helpers. The table is a single
+// replacement list whose invocations are rescanned one after the other, where a naive expander copies the
+// rest of the list at each of them
+inline std::string make_x_macro_source(size_t entry_count)
+{
+    std::string source = "#define TABLE(X) \\\n";
+    for (size_t n = 0; n < entry_count; n++)
+        source += fmt::format("    X(entry{}, {}) \\\n", n, n % 7);
+
+    source += "\n#define APPLY(f, ...) f(__VA_ARGS__)\n"
+              "#define ID(x) x\n"
+              "#define ENUM(name, value) ID(APPLY(ID, name)) = value,\n"
+              "#define NAME(name, value) [ID(name)] = #name,\n"
+              "#define EXPAND(table, x) table(x)\n"
+              "enum entries { EXPAND(TABLE, ENUM) };\n"
+              "char *names[] = { EXPAND(TABLE, NAME) };\n";
+    return source;
+}
+
+inline void bench_macro_expansion()
+{
+    fs::path filepath = fs::temp_directory_path() / "qcc-bench-x-macro.c";
+
+    fmt::println("{:<20}{:>10}{:>12}{:>14}{:>14}{:>12}", "x-macro expansion", "entries", "expansions",
+                 "tokens", "preprocess ms", "ns/entry");
+
+    for (size_t entry_count = 1 << 10; entry_count <= 1 << 16; entry_count *= 4) {
+        std::ofstream{filepath} << make_x_macro_source(entry_count);
+        size_t expansion_count = 0, token_count = 0;
+        float64 time = bench_time(
+            [&] {
+                Preprocessor preprocessor = {filepath};
+                preprocessor.thread_count = 1;
+                preprocessor.process();
+                expansion_count = preprocessor.expansion_count;
+                token_count = preprocessor.tokens.size();
+            },
+            3);
+
+        fmt::println("{:<20}{:>10}{:>12}{:>14}{:>14.1f}{:>12.1f}", "", entry_count, expansion_count,
+                     token_count, time, time * 1e6 / entry_count);
+    }
+
+    fs::remove(filepath);
+}
+
+} // namespace qcc
+
+#endif
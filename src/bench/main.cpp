@@ -0,0 +1,23 @@
+#include "macro_bench.hpp"
+#include "pipeline_bench.hpp"
+#include "regex_bench.hpp"
+#include "scan_bench.hpp"
+#include <algorithm>
+
+// Runs every benchmark, or only the ones named on the command line
+int main(int argc, char **argv)
+{
+    auto selected = [&](std::string_view name) {
+        return argc < 2 or std::find(argv + 1, argv + argc, name) != argv + argc;
+    };
+
+    if (selected("regex"))
+        qcc::bench_regex_compile();
+    if (selected("scan"))
+        qcc::bench_chunked_lexing();
+    if (selected("macro"))
+        qcc::bench_macro_expansion();
+    if (selected("pipeline"))
+        qcc::bench_pipeline();
+    return 0;
+}
@@ -0,0 +1,86 @@
+#ifndef QCC_PIPELINE_BENCH_HPP
+#define QCC_PIPELINE_BENCH_HPP
+
+#include "ast.hpp"
+#include "bench.hpp"
+#include "parser.hpp"
+#include "preprocess.hpp"
+#include <fstream>
+#include <optional>
+
+namespace qcc
+{
+
+// Functions the parser accepts, with a macro per statement so the preprocessor has its share of the work
+inline std::string make_function_source(size_t function_count)
+{
+    std::string source = "#define SCALE(x, n) ((x) * (n) + (x))\n#define CLAMP(x) ((x) & 255)\n";
+    for (size_t n = 0; n < function_count; n++) {
+        source += fmt::format("/* function {0} */\nint f{0}(int a, int b)\n{{\n"
+                              "    int c = SCALE(a, {0}) + b;\n    int d = CLAMP(c * {1});\n"
+                              "    return c - d + {0};\n}}\n\n",
+                              n, n % 13);
+    }
+    return source + "int main(void)\n{\n    return 0;\n}\n";
+}
+
+// The parser on the calling thread pulls the tokens itself, or reads them from the thread running the
+// preprocessor. The overlap is the share of the shorter phase hidden behind the longer one
+inline void bench_pipeline(size_t function_count = 1 << 17)
+{
+    fs::path filepath = fs::temp_directory_path() / "qcc-bench-pipeline.c";
+    std::ofstream{filepath} << make_function_source(function_count);
+
+    // Best wall time of the parse, which pulls the tokens as it goes unless they are all preprocessed first
+    size_t wait_count = 0;
+    auto front_end = [&](bool materialized, bool pipelined) {
+        float64 best = 0.0;
+        for (size_t n = 0; n < 3; n++) {
+            Ast ast = {};
+            Preprocessor preprocessor = {filepath};
+            preprocessor.thread_count = 1;
+            if (materialized)
+                preprocessor.process();
+
+            auto begin = std::chrono::steady_clock::now();
+            std::optional<Token_Pipe> pipe = {};
+            if (pipelined)
+                pipe.emplace(preprocessor);
+            else if (!materialized)
+                preprocessor.open_main();
+
+            Token_Stream token_stream = {preprocessor, pipe ? &*pipe : NULL};
+            Parser parser = {ast, pipe ? pipe->files : preprocessor.files, token_stream, false};
+            parser.parse();
+            std::chrono::duration<float64, std::milli> time = std::chrono::steady_clock::now() - begin;
+            best = n == 0 ? time.count() : Min(best, time.count());
+            if (pipe)
+                wait_count = pipe->empty_count + pipe->full_count;
+        }
+        return best;
+    };
+
+    float64 preprocess_time = bench_time(
+        [&] {
+            Preprocessor preprocessor = {filepath};
+            preprocessor.thread_count = 1;
+            preprocessor.process();
+        },
+        3);
+    float64 parse_time = front_end(true, false);
+    float64 streamed_time = front_end(false, false);
+    float64 pipelined_time = front_end(false, true);
+
+    float64 overlap = (preprocess_time + parse_time - pipelined_time) / Min(preprocess_time, parse_time);
+    fmt::println("{:<20}{:>14}{:>10}{:>14}{:>14}{:>10}{:>10}", "pipelined parse", "preprocess ms", "parse ms",
+                 "streamed ms", "pipelined ms", "overlap", "waits");
+    fmt::println("{:<20}{:>14.1f}{:>10.1f}{:>14.1f}{:>14.1f}{:>9.0f}%{:>10}",
+                 fmt::format("{} functions", function_count), preprocess_time, parse_time, streamed_time,
+                 pipelined_time, overlap * 100, wait_count);
+
+    fs::remove(filepath);
+}
+
+} // namespace qcc
+
+#endif
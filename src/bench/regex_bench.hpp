@@ -0,0 +1,56 @@
+#ifndef QCC_REGEX_BENCH_HPP
+#define QCC_REGEX_BENCH_HPP
+
+#include "bench.hpp"
+#include "regex.hpp"
+
+namespace qcc
+{
+
+inline std::string make_alternatives(size_t count)
+{
+    std::string src = {};
+    for (size_t n = 0; n < count; n++)
+        src += fmt::format("{}'w{}'", n != 0 ? " | " : "", n);
+    return src;
+}
+
+inline std::string make_nested_sequences(size_t count)
+{
+    return std::string(count, '{') + "'a'" + std::string(count, '}');
+}
+
+inline std::string make_loops(size_t count)
+{
+    std::string src = {};
+    for (size_t n = 0; n < count; n++)
+        src += fmt::format("{{'w{}' _}}+ ", n);
+    return src;
+}
+
+inline void bench_regex_compile()
+{
+    std::pair<std::string_view, std::string (*)(size_t)> generators[] = {
+        {"alternatives", make_alternatives},
+        {"nested sequences", make_nested_sequences},
+        {"loops", make_loops},
+    };
+
+    fmt::println("{:<20}{:>8}{:>12}{:>14}{:>14}", "regex compile", "count", "chars", "parse ms", "ns/char");
+
+    for (auto [name, generator] : generators) {
+        for (size_t count : {1000, 2000, 4000, 8000, 16000}) {
+            std::string src = generator(count);
+            float64 time = bench_time([&] {
+                regex::Node_Graph graph = {};
+                regex::Parser{src, graph}.parse();
+            });
+            fmt::println("{:<20}{:>8}{:>12}{:>14.3f}{:>14.1f}", name, count, src.size(), time,
+                         time * 1e6 / src.size());
+        }
+    }
+}
+
+} // namespace qcc
+
+#endif
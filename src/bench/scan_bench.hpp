@@ -0,0 +1,61 @@
+#ifndef QCC_SCAN_BENCH_HPP
+#define QCC_SCAN_BENCH_HPP
+
+#include "bench.hpp"
+#include "preprocess.hpp"
+#include <fstream>
+
+namespace qcc
+{
+
+// Table-like generated C, with the comments and strings a chunk may start inside of
+inline std::string make_generated_source(size_t size)
+{
+    std::string source = {};
+    source.reserve(size + 256);
+
+    for (size_t n = 0; source.size() < size; n++) {
+        source += fmt::format("/* entry {0}\n * generated\n */\n", n);
+        source += fmt::format("int table{0}[4] = {{{0}, {1}, {2}, 0x{0:x}}};\n", n, n * 3, n % 7);
+        source += fmt::format("char *name{0} = \"entry {0} \\\n continued\"; // {0}\n", n);
+        source += fmt::format("int get{0}(int i) {{ return table{0}[i & 3] + i * {0}; }}\n", n);
+    }
+    return source;
+}
+
+inline void bench_chunked_lexing(size_t size = 100 << 20)
+{
+    fs::path filepath = fs::temp_directory_path() / "qcc-bench-generated.c";
+    std::ofstream{filepath} << make_generated_source(size);
+    size_t max_thread_count = Max(std::thread::hardware_concurrency(), 1u);
+
+    fmt::println("{:<20}{:>8}{:>12}{:>14}{:>14}{:>10}", "chunked lexing", "threads", "MB", "preprocess ms",
+                 "MB/s", "speedup");
+
+    float64 serial_time = 0.0;
+    for (size_t thread_count = 1; thread_count <= max_thread_count; thread_count *= 2) {
+        size_t token_count = 0;
+        float64 time = bench_time(
+            [&] {
+                Preprocessor preprocessor = {filepath};
+                preprocessor.thread_count = thread_count;
+                preprocessor.process();
+                token_count = preprocessor.tokens.size();
+            },
+            3);
+
+        serial_time = thread_count == 1 ? time : serial_time;
+        float64 megabytes = (float64)size / (1 << 20);
+        fmt::println("{:<20}{:>8}{:>12.1f}{:>14.1f}{:>14.1f}{:>10.2f}", fmt::format("{} tokens", token_count),
+                     thread_count, megabytes, time, megabytes * 1e3 / time, serial_time / time);
+
+        if (thread_count < max_thread_count and thread_count * 2 > max_thread_count)
+            thread_count = max_thread_count / 2;
+    }
+
+    fs::remove(filepath);
+}
+
+} // namespace qcc
+
+#endif
@@ -6,6 +6,7 @@
 #include <fstream>
 #include <getopt.h>
 #include <iostream>
+#include <optional>
 #include <sys/wait.h>
 
 namespace qcc
@@ -32,7 +33,9 @@ std::string make_build_filepath(std::string_view filename, std::string_view exte
     return fmt::format("{}/{}{}", directory.string(), filename, extension);
 }
 
-int x86_compile(fs::path filepath, fs::path output, bool verbose)
+int x86_compile(fs::path filepath, fs::path output, bool verbose, fs::path cache_directory, bool cache_stats,
+                std::vector<fs::path> include_directories, bool list_include_directories, bool pipelined,
+                bool write_depfile, fs::path depfile)
 {
     fs::path directory = filepath.parent_path();
     std::string filename = filepath.stem().string();
@@ -51,19 +54,48 @@ int x86_compile(fs::path filepath, fs::path output, bool verbose)
 
     Ast ast = {};
     Preprocessor preprocessor = {filepath.string()};
-    preprocessor.process();
+    preprocessor.token_cache.directory = cache_directory;
+    preprocessor.include_directories = std::move(include_directories);
+    preprocessor.list_include_directories = list_include_directories;
+    // The parser pulls the tokens as it goes, or takes them from the thread running the preprocessor. The
+    // verbose mode prints them all first
+    std::optional<Token_Pipe> pipe = {};
     if (verbose) {
+        preprocessor.process();
         int32 pad = 0;
-        for (Token &token : preprocessor.tokens) {
-            pad = Max(pad, token.str.size());
+        for (Compact_Token token : preprocessor.tokens) {
+            pad = Max(pad, token.size);
         }
-        for (Token &token : preprocessor.tokens) {
+        for (Compact_Token compact : preprocessor.tokens) {
+            Token token = preprocessor.files.expand(compact);
             fmt::println(stderr, "{:{}?}{}", token.str, pad + 4, token.type_str);
         }
+    } else if (pipelined) {
+        pipe.emplace(preprocessor);
+    } else {
+        preprocessor.open_main();
     }
 
-    Parser parser = {ast, &preprocessor.tokens[0], verbose};
+    Token_Stream token_stream = {preprocessor, pipe ? &*pipe : NULL};
+    Parser parser = {ast, pipe ? pipe->files : preprocessor.files, token_stream, verbose};
     parser.parse();
+    if (cache_stats) {
+        const Token_Cache &cache = preprocessor.token_cache;
+        fmt::println(stderr, "token cache: {} hits, {} misses, {} bytes mapped", cache.hit_count,
+                     cache.miss_count, cache.mapped_size);
+        fmt::println(stderr, "include cache: {} resolved, {} hits, {} stat calls",
+                     preprocessor.includes.size(), preprocessor.include_cache_hit_count,
+                     preprocessor.include_probe_count);
+    }
+    // The sources are all processed once the parser read the Eof
+    if (write_depfile) {
+        fs::path depfile_path = depfile.empty() ? fs::path{output.string() + ".d"} : depfile;
+        std::ofstream{depfile_path} << preprocessor.dependency_rule(output.string());
+    }
+    if (verbose) {
+        fmt::println(stderr, "headers: {} reused, {} skipped", preprocessor.header_reuse_count,
+                     preprocessor.header_skip_count);
+    }
     Allocator allocator = {ast, 7, 7};
     allocator.allocate();
     if (verbose) {
@@ -91,18 +123,33 @@ int x86_compile(fs::path filepath, fs::path output, bool verbose)
 } // namespace qcc
 
 const std::string_view Usage = //
-    "./qcc -f <source-filepath> -o <output> -v\n"
+    "./qcc -f <source-filepath> -o <output> -C <cache-directory> -I <include-directory> -l -p -s -v\n"
+    "      -MD -MF <depfile>\n"
     " -f: C source code filepath\n"
     " -o: output path, defaulted to (dir/filename.c => dir/filename)\n"
+    " -C: token cache directory, the tokens of the headers are reused across runs\n"
+    " -I: include directory, searched in the order given\n"
+    " -l: lists the include directories once, headers are then looked up in the listings\n"
+    " -MD: writes the files read as a make rule of the output, to <output>.d\n"
+    " -MF: depfile path written by -MD instead\n"
+    " -p: preprocesses on another thread while parsing\n"
+    " -s: prints the token and include cache statistics\n"
     " -v: verbose mode, prints the ast";
 
 int main(int argc, char *argv[])
 {
     bool verbose = false;
+    bool cache_stats = false;
+    bool list_include_directories = false;
+    bool pipelined = false;
+    bool write_depfile = false;
+    std::string_view depfile = "";
+    std::vector<qcc::fs::path> include_directories = {};
     std::string_view filepath = "?";
     std::string_view output = "?";
+    std::string_view cache_directory = "";
 
-    for (int opt; (opt = getopt(argc, argv, "o:f:v")) != -1;) {
+    for (int opt; (opt = getopt(argc, argv, "o:f:C:I:M:lpsv")) != -1;) {
         switch (opt) {
         case 'v':
             verbose = true;
@@ -113,6 +160,34 @@ int main(int argc, char *argv[])
         case 'o':
             output = optarg;
             break;
+        case 'C':
+            cache_directory = optarg;
+            break;
+        case 'I':
+            include_directories.push_back(optarg);
+            break;
+        case 'l':
+            list_include_directories = true;
+            break;
+        case 'p':
+            pipelined = true;
+            break;
+        // '-MD', and '-MF <depfile>' or '-MF<depfile>'
+        case 'M':
+            if (optarg == std::string_view{"D"}) {
+                write_depfile = true;
+                break;
+            }
+            if (optarg[0] == 'F' and (optarg[1] != '\0' or optind < argc)) {
+                depfile = optarg[1] != '\0' ? optarg + 1 : argv[optind++];
+                break;
+            }
+            fmt::println(stderr, "unknown command line option '-M{}'", optarg);
+            fmt::println(stderr, "{}", Usage);
+            return 1;
+        case 's':
+            cache_stats = true;
+            break;
 
         default:
             fmt::println(stderr, "unknown command line option '{}'", opt);
@@ -127,5 +202,7 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    return qcc::x86_compile(filepath, output, verbose);
+    return qcc::x86_compile(filepath, output, verbose, cache_directory, cache_stats,
+                            std::move(include_directories), list_include_directories, pipelined,
+                            write_depfile, depfile);
 }
@@ -0,0 +1,108 @@
+#include "scan/syntax_map.hpp"
+#include <cctype>
+#include <fstream>
+#include <map>
+
+namespace qcc
+{
+
+std::string make_case_label(uint32 b)
+{
+    if (b < 0x80 and std::isalnum(b))
+        return fmt::format("case '{}':", (char)b);
+    return fmt::format("case {:#04x}:", b);
+}
+
+// The cell is entered with data[n] as the lookahead, a dead next state ends the match
+std::string make_cell_code(uint32 cell, std::string_view indent)
+{
+    uint32 state = cell & regex::Dfa_State_Mask;
+    int32 pattern = (int32)(cell >> regex::Dfa_Accept_Shift) - 1;
+
+    if (state == regex::Dfa_Dead) {
+        if (pattern >= 0)
+            return fmt::format("{}return {{n, {}}};\n", indent, pattern);
+        return fmt::format("{}return match;\n", indent);
+    }
+
+    std::string code = {};
+    if (pattern >= 0)
+        code += fmt::format("{}match = {{n, {}}};\n", indent, pattern);
+    code += fmt::format("{}n++;\n{}goto state_{};\n", indent, indent, state);
+    return code;
+}
+
+std::string make_state_code(const regex::Dfa &dfa, uint32 state)
+{
+    const uint32 *row = &dfa.table[state * regex::Dfa_Columns];
+    std::map<uint32, std::vector<uint32>> cases = {};
+    for (uint32 b = 0; b < 256; b++)
+        cases[row[b]].push_back(b);
+
+    // The most common cell is the default branch
+    uint32 fallback = row[0];
+    for (const auto &[cell, bytes] : cases) {
+        if (bytes.size() > cases[fallback].size())
+            fallback = cell;
+    }
+
+    std::string code = fmt::format("state_{}:\n    if (n >= size) {{\n", state);
+    code += make_cell_code(row[regex::Dfa_Eof], "        ");
+    code += "    }\n    switch (data[n]) {\n";
+
+    for (const auto &[cell, bytes] : cases) {
+        if (cell == fallback)
+            continue;
+        for (uint32 b : bytes)
+            code += fmt::format("    {}\n", make_case_label(b));
+        code += make_cell_code(cell, "        ");
+    }
+
+    code += "    default:\n";
+    code += make_cell_code(fallback, "        ");
+    code += "    }\n\n";
+    return code;
+}
+
+std::string make_lexer_code(const regex::Dfa &dfa)
+{
+    std::string code = "// Generated by qcc-lexgen from syntax_map_c89(), do not edit\n"
+                       "#include \"scan/lexer_c89.hpp\"\n\n"
+                       "namespace qcc\n{\n\n"
+                       "regex::Dfa_Match lex_c89(std::string_view stream)\n{\n"
+                       "    const uint8 *data = (const uint8 *)stream.data();\n"
+                       "    size_t size = stream.size();\n"
+                       "    regex::Dfa_Match match = {npos, -1};\n"
+                       "    size_t n = 0;\n\n";
+    code += fmt::format("    goto state_{};\n\n", dfa.start);
+
+    for (uint32 state = 1; state < dfa.state_count(); state++)
+        code += make_state_code(dfa, state);
+
+    code += "    return match;\n}\n\n} // namespace qcc\n";
+    return code;
+}
+
+} // namespace qcc
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fmt::println(stderr, "usage: qcc-lexgen <output>");
+        return 1;
+    }
+
+    const qcc::regex::Dfa &dfa = qcc::syntax_map_automaton(qcc::syntax_map_c89());
+    if (!dfa.ok) {
+        fmt::println(stderr, "qcc-lexgen: the C89 syntax map does not fit in a Dfa");
+        return 1;
+    }
+
+    std::ofstream output(argv[1]);
+    output << qcc::make_lexer_code(dfa);
+    if (!output) {
+        fmt::println(stderr, "qcc-lexgen: cannot write '{}'", argv[1]);
+        return 1;
+    }
+    return 0;
+}
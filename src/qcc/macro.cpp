@@ -0,0 +1,79 @@
+#include "macro.hpp"
+#include <algorithm>
+
+namespace qcc
+{
+
+Symbol Symbol_Table::intern(std::string_view name)
+{
+    auto [it, inserted] = ids.emplace(name, names.size());
+    if (inserted)
+        names.push_back(name);
+    return it->second;
+}
+
+Symbol Symbol_Table::find(std::string_view name) const
+{
+    auto it = ids.find(name);
+    return it != ids.end() ? it->second : Symbol_None;
+}
+
+bool Hideset_Table::contains(uint32 set, Symbol symbol) const
+{
+    return std::binary_search(sets[set].begin(), sets[set].end(), symbol);
+}
+
+uint32 Hideset_Table::insert(uint32 set, Symbol symbol)
+{
+    auto [it, inserted] = insertions.emplace((uint64)set << 32 | symbol, 0);
+    if (inserted) {
+        std::vector<Symbol> symbols = sets[set];
+        auto at = std::lower_bound(symbols.begin(), symbols.end(), symbol);
+        if (at == symbols.end() or *at != symbol)
+            symbols.insert(at, symbol);
+        it->second = intern(std::move(symbols));
+    }
+    return it->second;
+}
+
+uint32 Hideset_Table::merge(uint32 a, uint32 b)
+{
+    if (a == b or b == 0)
+        return a;
+    if (a == 0)
+        return b;
+
+    auto [it, inserted] = unions.emplace((uint64)Min(a, b) << 32 | Max(a, b), 0);
+    if (inserted) {
+        std::vector<Symbol> symbols = {};
+        std::set_union(sets[a].begin(), sets[a].end(), sets[b].begin(), sets[b].end(),
+                       std::back_inserter(symbols));
+        it->second = intern(std::move(symbols));
+    }
+    return it->second;
+}
+
+uint32 Hideset_Table::intersect(uint32 a, uint32 b)
+{
+    if (a == b or a == 0 or b == 0)
+        return Min(a, b);
+
+    auto [it, inserted] = intersections.emplace((uint64)Min(a, b) << 32 | Max(a, b), 0);
+    if (inserted) {
+        std::vector<Symbol> symbols = {};
+        std::set_intersection(sets[a].begin(), sets[a].end(), sets[b].begin(), sets[b].end(),
+                              std::back_inserter(symbols));
+        it->second = intern(std::move(symbols));
+    }
+    return it->second;
+}
+
+uint32 Hideset_Table::intern(std::vector<Symbol> &&set)
+{
+    auto [it, inserted] = ids.emplace(set, sets.size());
+    if (inserted)
+        sets.push_back(std::move(set));
+    return it->second;
+}
+
+} // namespace qcc
@@ -0,0 +1,111 @@
+#ifndef QCC_MACRO_HPP
+#define QCC_MACRO_HPP
+
+#include "scan/token.hpp"
+#include <map>
+#include <span>
+#include <unordered_map>
+
+namespace qcc
+{
+
+struct Token_Record;
+
+typedef uint32 Symbol;
+
+constexpr Symbol Symbol_None = (Symbol)-1;
+
+// Names interned once, the symbol of a name is its index
+struct Symbol_Table
+{
+    std::unordered_map<std::string_view, Symbol> ids;
+    std::vector<std::string_view> names;
+
+    Symbol intern(std::string_view name);
+    Symbol find(std::string_view name) const;
+};
+
+// Sorted sets of symbols interned once, the empty set is 0. The operations are memoized, the tokens of an
+// expansion share the id of their hideset
+struct Hideset_Table
+{
+    std::vector<std::vector<Symbol>> sets = {{}};
+    std::map<std::vector<Symbol>, uint32> ids = {{{}, 0}};
+    std::unordered_map<uint64, uint32> insertions;
+    std::unordered_map<uint64, uint32> unions;
+    std::unordered_map<uint64, uint32> intersections;
+
+    bool contains(uint32 set, Symbol symbol) const;
+    uint32 insert(uint32 set, Symbol symbol);
+    uint32 merge(uint32 a, uint32 b);
+    uint32 intersect(uint32 a, uint32 b);
+    uint32 intern(std::vector<Symbol> &&set);
+};
+
+// Token of a replacement list, with the index of the parameter it names or -1
+struct Macro_Token
+{
+    Compact_Token token;
+    int32 param;
+};
+
+// The replacement list is a range of the macro tokens of the preprocessor. A macro without parameters in its
+// body nor '#' or '##' is rescanned in place, the others are substituted first
+struct Macro
+{
+    uint32 body_begin;
+    uint32 body_end;
+    uint32 param_count;
+    bool function_like;
+    bool variadic;
+    bool substituted;
+    bool defined;
+};
+
+// Token being rescanned, with the set of the macros it cannot expand to
+struct Expanded_Token
+{
+    Compact_Token token;
+    uint32 hideset;
+};
+
+// Replacement list being rescanned, the tokens of a substituted one are in the input instead of the macro
+// tokens. A frame read in place gives its hideset to every token
+struct Macro_Frame
+{
+    uint32 begin;
+    uint32 next;
+    uint32 end;
+    uint32 hideset;
+    bool substituted;
+};
+
+// The frames are read from the top, the substituted tokens go with their frame. Once they are read the
+// input goes on with the source, or ends for the input of an argument
+struct Macro_Input
+{
+    std::vector<Macro_Frame> frames;
+    std::vector<Expanded_Token> substituted;
+    Source_Context *context;
+    Token_Record *record;
+    int128 skip_mask;
+    Token lookahead;
+};
+
+// Arguments of an invocation, an argument is expanded once and only when the body needs it expanded
+struct Macro_Arguments
+{
+    std::vector<Expanded_Token> tokens;
+    std::vector<uint32> bounds;
+    std::vector<std::vector<Expanded_Token>> expanded;
+    std::vector<bool> is_expanded;
+
+    std::span<const Expanded_Token> operator[](size_t n) const
+    {
+        return std::span{tokens}.subspan(bounds[n], bounds[n + 1] - bounds[n]);
+    }
+};
+
+} // namespace qcc
+
+#endif
@@ -11,7 +11,10 @@
 namespace qcc
 {
 
-Parser::Parser(Ast &ast, Token *source, bool verbose) : ast(ast), source(source), verbose(verbose) {}
+Parser::Parser(Ast &ast, const File_Table &files, Token_Stream &source, bool verbose) :
+    ast(ast), files(files), source(source), verbose(verbose)
+{
+}
 
 Statement *Parser::parse()
 {
@@ -802,7 +805,7 @@ Expression *Parser::parse_increment_expression(Token operation, Expression *oper
 
     if (precedence_now >= precedence) {
         operand->endpoint = true;
-        source--;
+        source.retreat();
         return operand;
     }
 
@@ -824,7 +827,7 @@ Expression *Parser::parse_unary_expression(Token operation, Expression_Order ord
     int32 precedence_now = unary_operator_precedence(operation.type, order);
     if (precedence_now >= precedence) {
         operand->endpoint = true;
-        source--;
+        source.retreat();
         return operand;
     }
 
@@ -863,7 +866,7 @@ Expression *Parser::parse_binary_expression(Token operation, Expression *lhs, in
 
     int32 precedence_now = binary_operator_precedence(operation.type);
     if (precedence_now >= precedence) {
-        source--;
+        source.retreat();
         lhs->endpoint = true;
         return lhs;
     }
@@ -1230,7 +1233,7 @@ Token Parser::peek_until(int128 mask)
 {
     Token token = peek(mask);
 
-    if (!token.ok and !(source->type & Token_Eof))
+    if (!token.ok and !(source.peek().type() & Token_Eof))
         return token;
     if (!token.ok)
         throw errorf("unexpected end of file", token);
@@ -1310,19 +1313,19 @@ int64 Parser::parse_constant(Token token, Expression *expression)
 
 Token Parser::peek(int128 mask)
 {
-    Token token = *source;
+    Token token = files.expand(source.peek());
     token.ok = token.type & mask;
     return token;
 }
 
 Token Parser::scan(int128 mask)
 {
-    if (source->type & Token_Eof)
-        return *source;
-    Token token = *source;
+    Token token = files.expand(source.peek());
+    if (token.type & Token_Eof)
+        return token;
     token.ok = token.type & mask;
     if (token.ok)
-        source++;
+        source.advance();
     return token;
 }
 
@@ -3,7 +3,9 @@
 
 #include "fwd.hpp"
 #include "operators.hpp"
+#include "scan/file_table.hpp"
 #include "source_snippet.hpp"
+#include "token_stream.hpp"
 #include "type_system.hpp"
 #include <deque>
 
@@ -28,12 +30,13 @@ enum Expression_Category
 struct Parser
 {
     Ast &ast;
-    Token *source;
+    const File_Table &files;
+    Token_Stream &source;
     Type_System type_system;
     std::deque<Statement *> context;
     bool verbose;
 
-    Parser(Ast &ast, Token *source, bool verbose);
+    Parser(Ast &ast, const File_Table &files, Token_Stream &source, bool verbose);
 
     Statement *parse();
     Statement *parse_statement();
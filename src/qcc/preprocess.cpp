@@ -1,79 +1,1055 @@
 #include "preprocess.hpp"
+#include "scan/keyword.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <sys/stat.h>
 
 namespace qcc
 {
 
 const fs::path Libs = "/lib/";
+constexpr size_t Scratch_Capacity = 64 << 10;
+constexpr size_t Step_Batch_Size = 256;
+
+static bool starts_line(std::string_view source, const char *at)
+{
+    while (at > source.data() and (at[-1] == ' ' or at[-1] == '\t'))
+        at--;
+    return at == source.data() or at[-1] == '\n';
+}
+
+// The frames read to the end are dropped with their substituted tokens, false once none is left
+static bool pop_read_frames(Macro_Input *input)
+{
+    while (!input->frames.empty() and input->frames.back().next == input->frames.back().end) {
+        if (input->frames.back().substituted)
+            input->substituted.resize(input->frames.back().begin);
+        input->frames.pop_back();
+    }
+    return !input->frames.empty();
+}
 
 Preprocessor::Preprocessor(fs::path filepath) :
     filepath(fs::absolute(filepath).string()), cwd(filepath.parent_path())
 {
 }
 
+// Paths of the headers left to lex, a path is only queued once
+struct Prefetch_Queue
+{
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<fs::path> paths;
+    std::unordered_set<std::string> queued;
+    size_t active_count = 0;
+    std::unordered_map<std::string, Prefetched_File> *prefetched;
+};
+
 void Preprocessor::process()
 {
-    Token &filepath_token = macros.emplace_back(Token{filepath});
-    Source_Context main_context = fs_open(filepath, filepath_token);
-    process_context(&main_context, true);
+    open_main();
+    while (!open_sources.empty())
+        step();
 }
 
-void Preprocessor::process_context(Source_Context *context, bool has_eof, int128 skip_mask)
+void Preprocessor::open_main()
 {
-    Token token = {};
-    while (token.type != Token_Eof) {
-        token = scanner.tokenize(context, syntax_map_c89(), skip_mask);
+    Source_Context main_context = fs_open(filepath, Token{filepath});
+    struct stat status = {};
+    if (stat(filepath.c_str(), &status) == 0)
+        dependency_keys.insert({status.st_dev, status.st_ino});
+    dependencies.push_back(filepath);
+    if (thread_count > 1)
+        prefetch(main_context);
+
+    Open_Source &main = push_source(main_context, true, Token_Mask_Skip);
+    if (thread_count > 1 and lex_chunks(main.context, &main.record))
+        main.input.record = &main.record;
+}
+
+// Steps until the sources give tokens, false once they are all read and pulled
+bool Preprocessor::pull()
+{
+    while (tokens.empty() and !open_sources.empty())
+        step();
+    return !tokens.empty();
+}
+
+// Lexes the headers reachable from the '#include' lines of the sources on a pool of threads. Only the raw
+// tokens are produced here, the serial pass replays them in include order so the output does not depend on
+// the threads
+void Preprocessor::prefetch(Source_Context main_context)
+{
+    Prefetch_Queue queue = {};
+    queue.prefetched = &prefetched;
+    queue_includes(main_context, &queue);
+    if (queue.paths.empty())
+        return;
+
+    auto work = [&] {
+        Preprocessor lexer = {filepath};
+        lexer.lex_only = true;
+        lexer.token_cache.directory = token_cache.directory;
+        lexer.include_directories = include_directories;
+        lexer.list_include_directories = list_include_directories;
+
+        for (std::unique_lock lock{queue.mutex};;) {
+            queue.ready.wait(lock, [&] { return !queue.paths.empty() or queue.active_count == 0; });
+            if (queue.paths.empty())
+                break;
+
+            fs::path path = std::move(queue.paths.front());
+            queue.paths.pop_front();
+            queue.active_count++;
+            lock.unlock();
+
+            lexer.prefetch_file(path, &queue);
+
+            lock.lock();
+            queue.active_count--;
+            if (queue.paths.empty() and queue.active_count == 0)
+                queue.ready.notify_all();
+        }
+
+        std::lock_guard lock{queue.mutex};
+        scanner.token_count += lexer.scanner.token_count;
+        scanner.attempt_count += lexer.scanner.attempt_count;
+        scanner.sequential_attempt_count += lexer.scanner.sequential_attempt_count;
+    };
+
+    std::vector<std::jthread> workers = {};
+    for (size_t n = 1; n < thread_count; n++)
+        workers.emplace_back(work);
+    work();
+}
+
+// Called on a lexer, the tokens go to the preprocessor that owns the queue. The path was found when it was
+// queued. A file that fails to open or to lex is left to the serial pass, which reports the error
+void Preprocessor::prefetch_file(const fs::path &filepath, Prefetch_Queue *queue)
+{
+    std::string filepath_str = filepath.string();
+    Token_Record record = {};
+    size_t source_size = 0;
+    bool lexed = false;
+
+    try {
+        Source_Context context = files.open_file(filepath, Token{filepath_str});
+        queue_includes(context, queue);
+
+        Include_Guard guard = detect_include_guard(context.source);
+        if (guard.kind == Include_Guard_Macro)
+            context.stream = context.source.substr(guard.body_begin, guard.body_end - guard.body_begin);
+
+        // A cached file is replayed from the cache by the serial pass
+        if (!token_cache.enabled() or !token_cache.load(context.source, &record)) {
+            process_context(&context, false, Token_Mask_Skip, &record);
+            lexed = true;
+        }
+        source_size = context.source.size();
+    } catch (const std::exception &) {
+        lexed = false;
+    }
+
+    files.files.clear();
+    tokens.clear();
+    token_cache.mappings.clear();
+    if (lexed) {
+        std::lock_guard lock{queue->mutex};
+        (*queue->prefetched)[filepath_str] = {std::move(record.tokens), source_size};
+    }
+}
+
+// Cheap pre-scan of the '#include' lines, the includes the pre-scan misses are lexed by the serial pass
+void Preprocessor::queue_includes(Source_Context context, Prefetch_Queue *queue)
+{
+    std::string_view source = context.source;
+    for (size_t i = 0, end = 0; i < source.size(); i = end + 1) {
+        if (directive_name(source, i, &end) != "include")
+            continue;
+        std::string_view operand = include_operand(source, i, end);
+        if (operand.empty())
+            continue;
+
+        const Include_File &file = resolve_include(operand, files.files[context.hash].directory);
+        if (!file.found)
+            continue;
+
+        std::lock_guard lock{queue->mutex};
+        if (queue->queued.insert(file.filepath.string()).second) {
+            queue->paths.push_back(file.filepath);
+            queue->ready.notify_one();
+        }
+    }
+}
+
+// Splits the source at line starts and lexes the chunks on a pool of threads. A chunk assumes its first line
+// starts outside of a comment or a string, the speculation holds from its first token that starts where the
+// previous chunk stopped. Until then the chunk is lexed again, in steps from one line start to the next
+bool Preprocessor::lex_chunks(Source_Context context, Token_Record *record)
+{
+    size_t chunk_count = Min(context.source.size() / Max(chunk_size, 1ul), thread_count * 4);
+    if (chunk_count < 2)
+        return false;
+
+    const char *source_end = context.source.data() + context.source.size();
+    std::vector<const char *> bounds = {context.source.data()};
+    for (size_t n = 1; n < chunk_count; n++) {
+        size_t line_end = context.source.find('\n', n * context.source.size() / chunk_count);
+        const char *bound = context.source.data() + line_end + 1;
+        if (line_end != npos and bound > bounds.back() and bound < source_end)
+            bounds.push_back(bound);
+    }
+    bounds.push_back(source_end);
+
+    std::vector<Lexed_Chunk> chunks(bounds.size() - 1);
+    std::atomic<size_t> next_chunk = 0;
+    auto work = [&] {
+        Preprocessor lexer = {filepath};
+        lexer.lex_only = true;
+        for (size_t n; (n = next_chunk.fetch_add(1)) < chunks.size();) {
+            // A chunk that fails to lex started at the wrong place, or the error is met again on the way
+            try {
+                lexer.lex_chunk(context, bounds[n], bounds[n + 1], &chunks[n]);
+            } catch (const Error &) {
+                chunks[n] = {};
+            }
+        }
+    };
+
+    std::vector<std::jthread> workers = {};
+    for (size_t n = 1; n < Min(thread_count, chunks.size()); n++)
+        workers.emplace_back(work);
+    work();
+    for (std::jthread &worker : workers)
+        worker.join();
+
+    size_t token_count = 0;
+    for (const Lexed_Chunk &chunk : chunks)
+        token_count += chunk.tokens.size();
+    record->tokens.reserve(token_count + 1);
+
+    Preprocessor lexer = {filepath};
+    lexer.lex_only = true;
+    const char *next = context.source.data();
+
+    for (size_t n = 0, line = 0; n < chunks.size(); n++, line = 0) {
+        Lexed_Chunk &chunk = chunks[n];
+        auto line_start = [&](size_t index) {
+            return context.source.data() + chunk.tokens[chunk.lines[index]].offset;
+        };
+
+        while (next != NULL and next < bounds[n + 1]) {
+            while (line < chunk.lines.size() and line_start(line) < next)
+                line++;
+
+            if (line < chunk.lines.size() and line_start(line) == next) {
+                record->tokens.insert(record->tokens.end(), chunk.tokens.begin() + chunk.lines[line],
+                                      chunk.tokens.end());
+                next = chunk.next;
+                break;
+            }
+
+            Lexed_Chunk relexed = {};
+            const char *end = line < chunk.lines.size() ? line_start(line) : bounds[n + 1];
+            lexer.lex_chunk(context, next, end, &relexed);
+            record->tokens.insert(record->tokens.end(), relexed.tokens.begin(), relexed.tokens.end());
+            next = relexed.next;
+            chunk_relex_count++;
+        }
+        chunk = {};
+    }
+
+    record->replay = record->tokens;
+    record->next = 0;
+    record->replaying = true;
+    return true;
+}
+
+// Called on a lexer, the stream runs to the end of the source so the tokens across the end of the chunk are
+// matched whole. The chunk stops at Eof, or before the first token past its end read outside of a directive
+void Preprocessor::lex_chunk(Source_Context context, const char *begin, const char *end, Lexed_Chunk *chunk)
+{
+    Token_Record record = {};
+    context.stream = {begin, context.source.data() + context.source.size()};
+    lex_end = end;
+    line_tokens.clear();
+    process_context(&context, true, Token_Mask_Skip, &record);
+
+    chunk->tokens = std::move(record.tokens);
+    chunk->lines = std::move(line_tokens);
+    chunk->next = context.stream.empty() ? NULL : context.stream.data();
+}
+
+bool Preprocessor::take_prefetched(const fs::path &filepath, std::string_view source,
+                                   Token_Record *record) const
+{
+    auto it = prefetched.find(filepath.string());
+    if (it == prefetched.end() or it->second.source_size != source.size())
+        return false;
+
+    record->replay = it->second.tokens;
+    record->next = 0;
+    record->replaying = true;
+    return true;
+}
 
-        if (token.type & Token_Newline)
-            context->line++;
-        else if (token.type & Token_Mask_Hash)
-            process_hash_token(context, token);
-        else if (has_eof or token.type != Token_Eof) {
-            tokens.push_back(token);
-	}
+// Reads the source to its end, the source of an include it opens is read before it goes on
+void Preprocessor::process_context(Source_Context *context, bool has_eof, int128 skip_mask,
+                                   Token_Record *record)
+{
+    size_t depth = open_sources.size();
+    Open_Source &source = push_source({}, has_eof, skip_mask);
+    source.input.context = context;
+    source.input.record = record;
+
+    try {
+        while (open_sources.size() > depth)
+            step();
+    } catch (...) {
+        open_sources.resize(depth);
+        throw;
     }
 }
 
-void Preprocessor::process_hash_token(Source_Context *context, Token hash)
+// Reads a batch of tokens of the source on top. The step ends early at a directive, which may open an
+// include, and at the end of the source
+void Preprocessor::step()
+{
+    Open_Source &source = open_sources.back();
+    Macro_Input &input = source.input;
+    Source_Context *context = input.context;
+    Token_Record *record = input.record;
+    bool has_eof = source.has_eof;
+
+    for (size_t count = 0; count < Step_Batch_Size; count++) {
+        // The expansions are rescanned before the source moves on
+        Expanded_Token expanded = {};
+        if (pop_read_frames(&input) and next_input(&input, &expanded)) {
+            if (!expand_macro(&input, expanded))
+                emit(expanded.token);
+            continue;
+        }
+
+        Token token = {};
+        if (input.lookahead.type) {
+            token = std::exchange(input.lookahead, Token{});
+        } else {
+            // Replayed tokens outside of directives and macro invocations go to the output as they are
+            if (record != NULL and record->replaying and record->gap_end == 0 and !lex_only) {
+                Compact_Token compact = record->replay[record->next];
+                bool passes = !(compact.type() & (Token_Mask_Hash | Token_Eof | macro_name_types));
+                if (compact.kind != Token_Kind_Gap and passes) {
+                    compact.file = context->hash;
+                    emit(compact);
+                    record->next++;
+                    continue;
+                }
+            }
+
+            // Lines are resolved from the line starts of the file when a diagnostic needs them
+            token = next_token(context, syntax_map_c89(), input.skip_mask, record);
+
+            if (lex_end != NULL and token.type != Token_Eof) {
+                if (token.str.data() >= lex_end) {
+                    record->tokens.pop_back();
+                    context->stream = {token.str.data(), context->stream.data() + context->stream.size()};
+                    open_sources.pop_back();
+                    return;
+                }
+                if (starts_line(context->source, token.str.data()))
+                    line_tokens.push_back(record->tokens.size() - 1);
+            }
+        }
+
+        if (token.type & Token_Mask_Hash) {
+            process_hash_token(context, token, record);
+            return;
+        }
+        if (token.type & macro_name_types and expand_macro(&input, {files.compact(token), 0}))
+            continue;
+        if (!lex_only and (has_eof or token.type != Token_Eof))
+            emit(files.compact(token));
+        if (token.type == Token_Eof) {
+            close_source();
+            return;
+        }
+    }
+}
+
+// The tokens of the open includes are kept, a header that turns out reusable takes its own
+void Preprocessor::emit(Compact_Token token)
+{
+    tokens.push_back(token);
+    if (include_depth != 0)
+        header_tokens.push_back(token);
+}
+
+// The input reads the context the source owns unless the caller gives its own
+Open_Source &Preprocessor::push_source(Source_Context context, bool has_eof, int128 skip_mask)
+{
+    Open_Source &source = open_sources.emplace_back();
+    source.context = context;
+    source.input = {{}, {}, &source.context, NULL, skip_mask | Token_Newline, {}};
+    source.has_eof = has_eof;
+    source.conditional_count = conditionals.size();
+    return source;
+}
+
+void Preprocessor::close_source()
+{
+    Open_Source &source = open_sources.back();
+    if (conditionals.size() > source.conditional_count)
+        throw errorf("unterminated conditional directive", conditionals.back().token);
+
+    if (source.include) {
+        Token_Record &record = source.record;
+        if (token_cache.enabled() and !source.cached)
+            token_cache.store(source.context.source, source.prefetched ? record.replay : record.tokens);
+
+        Header &header = source.header;
+        header.macro_change_count = macro_change_count;
+        header.reusable =
+            guarded_header_count == source.guarded_count and define_directive_count == source.define_count;
+        if (header.reusable)
+            header.tokens.assign(header_tokens.begin() + source.header_begin, header_tokens.end());
+        headers[source.header_key] = std::move(header);
+        if (--include_depth == 0)
+            header_tokens.clear();
+    }
+    open_sources.pop_back();
+}
+
+void Preprocessor::process_hash_token(Source_Context *context, Token hash, Token_Record *record)
 {
     switch (hash.type) {
     case Token_Hash_Include: {
-        Token filepath_token = scanner.tokenize(context, syntax_map_include());
-        fs::path filepath = {
-            filepath_token.str.begin() + 1,
-            filepath_token.str.end() - 1,
-        };
+        Token filepath_token = next_token(context, syntax_map_include(), Token_Mask_Skip, record);
+        if (!lex_only)
+            process_include(resolve_include(filepath_token.str, files.files[context->hash].directory),
+                            filepath_token);
+        break;
+    }
+    case Token_Hash_Pragma: {
+        // '#pragma once' guards the include being read, the other pragmas are ignored
+        Token pragma = read_line(context, record);
+        Open_Source &source = open_sources.back();
+        bool unguarded = source.include and source.header.guard.kind == Include_Guard_None;
+        if (!lex_only and unguarded and pragma.str == "once") {
+            source.header.guard.kind = Include_Guard_Once;
+            guarded_header_count++;
+        }
+        break;
+    }
+    case Token_Hash_Define:
+    case Token_Hash_Undef: {
+        Token name = next_token(context, syntax_map_c89(), Token_Mask_Skip, record);
+        if (keyword_type(name.str) != name.type)
+            throw errorf("macro names must be identifiers", name);
 
-        if (filepath_token.type & Token_Hash_System_Filepath)
-            filepath = Libs / filepath;
-        if (filepath_token.type & Token_Hash_Cwd_Filepath or !fs::exists(filepath))
-            filepath = cwd / filepath;
+        // The tokens following the name of an '#undef' are dropped
+        std::vector<Compact_Token> line = {};
+        read_line(context, record, hash.type == Token_Hash_Define and !lex_only ? &line : NULL);
+        if (lex_only)
+            break;
 
-        Source_Context include_context = fs_open(filepath, filepath_token);
-        process_context(&include_context);
+        Symbol symbol = symbols.find(name.str);
+        if (hash.type == Token_Hash_Define)
+            define_macro(name, line);
+        else if (symbol != Symbol_None)
+            macros[symbol].defined = false;
+        macro_change_count++;
+        define_directive_count++;
         break;
     }
+    case Token_Hash:
+        // A '#' alone on its line is the null directive
+        if (!(read_line(context, record).type & (Token_Newline | Token_Eof)))
+            throw errorf("unsupported directive", hash);
+        break;
+    case Token_Hash_Ifdef:
+    case Token_Hash_Ifndef:
+    case Token_Hash_Elif:
+    case Token_Hash_Else:
+    case Token_Hash_Endif:
+        process_conditional(context, hash, record);
+        break;
     default:
+        // A lexer may be reading a comment as code, it gives up and leaves the directive to the serial pass
+        if (lex_only)
+            throw errorf("unsupported directive", hash);
         qcc_assert(0, "Todo! process_hash_token() support for hash directive type");
     }
 }
 
+// The operands are read the same way by a lexer. It does not know which groups are taken, each one is left to
+// a gap of its record and the serial pass scans the one it takes
+void Preprocessor::process_conditional(Source_Context *context, Token hash, Token_Record *record)
+{
+    // The rest of the line is dropped, the expression of an '#elif' as the tokens following an operand
+    Token operand = {};
+    if (hash.type & (Token_Hash_Ifdef | Token_Hash_Ifndef))
+        operand = next_token(context, syntax_map_c89(), Token_Mask_Skip, record);
+    if (!(operand.type & (Token_Newline | Token_Eof)))
+        read_line(context, record);
+    if (lex_only) {
+        if (hash.type != Token_Hash_Endif)
+            skip_inactive_group(context, false, record);
+        return;
+    }
+
+    define_directive_count++;
+    if (hash.type & (Token_Hash_Ifdef | Token_Hash_Ifndef)) {
+        bool taken = is_defined(operand.str) == (hash.type == Token_Hash_Ifdef);
+        conditionals.push_back({hash, taken});
+        if (!taken)
+            skip_inactive_group(context, false, record);
+        return;
+    }
+
+    if (conditionals.empty())
+        throw errorf("{} without #ifdef or #ifndef", hash, token_type_str(hash.type));
+
+    if (hash.type == Token_Hash_Endif) {
+        conditionals.pop_back();
+    } else if (conditionals.back().taken) {
+        skip_inactive_group(context, true, record);
+    } else if (hash.type == Token_Hash_Elif) {
+        // An '#elif' following a group that was not taken needs its expression evaluated
+        throw errorf("'#elif' is not supported", hash);
+    } else {
+        conditionals.back().taken = true;
+    }
+}
+
+// Moves the stream to the line closing the group without tokenizing it. A replayed record moves past the
+// tokens of the group, a recorded one gets a gap in their place. A gap recorded after a taken group runs to
+// its '#endif', the line closing an untaken group may fall in it and the replay then scans the gap from there
+void Preprocessor::skip_inactive_group(Source_Context *context, bool to_endif, Token_Record *record)
+{
+    size_t begin = context->stream.data() - context->source.data();
+    size_t end = qcc::skip_inactive_group(context->source, begin, to_endif);
+    const char *at = context->source.data() + end;
+    const char *stream_end = context->stream.data() + context->stream.size();
+
+    if (record != NULL and record->replaying) {
+        auto it = std::lower_bound(record->replay.begin() + record->next, record->replay.end(), end,
+                                   [](const Compact_Token &token, size_t end) { return token.offset < end; });
+        record->next = it - record->replay.begin();
+        const Compact_Token *gap = record->next != 0 ? &record->replay[record->next - 1] : NULL;
+        if (gap != NULL and gap->kind == Token_Kind_Gap and gap->offset + gap->size > end)
+            record->gap_end = gap->offset + gap->size;
+    } else if (record != NULL) {
+        record->tokens.push_back(Compact_Token{(uint32)begin, (uint32)(end - begin), 0, Token_Kind_Gap});
+    }
+
+    context->stream = {at, stream_end};
+}
+
+// Tokens up to the end of the directive line, the first one is returned and every one is added to the line
+Token Preprocessor::read_line(Source_Context *context, Token_Record *record, std::vector<Compact_Token> *line)
+{
+    Token first = next_token(context, syntax_map_c89(), Token_Mask_Skip, record);
+    for (Token token = first; !(token.type & (Token_Newline | Token_Eof));) {
+        if (line != NULL)
+            line->push_back(files.compact(token));
+        token = next_token(context, syntax_map_c89(), Token_Mask_Skip, record);
+    }
+    return first;
+}
+
+// A function-like macro has its '(' right after its name, the parameters are identifiers up to the ')' and
+// '...' makes the macro variadic. The tokens of the replacement list are kept with the parameter they name
+void Preprocessor::define_macro(Token name, std::span<const Compact_Token> line)
+{
+    auto token_at = [&](size_t n) {
+        if (n >= line.size())
+            throw errorf("missing ')' in the parameters of macro '{}'", name, name.str);
+        return files.expand(line[n]);
+    };
+
+    bool function_like = !line.empty() and line[0].type() == Token_Paren_Begin and
+                         files.str(line[0]).data() == name.str.data() + name.str.size();
+    std::vector<std::string_view> params = {};
+    bool variadic = false;
+    size_t n = 0;
+
+    if (function_like) {
+        n = 2;
+        for (Token token = token_at(1); token.type != Token_Paren_End; token = token_at(n++)) {
+            if (!params.empty()) {
+                if (token.type != Token_Comma or variadic)
+                    throw errorf("expected ',' or ')' in the parameters of macro '{}'", token, name.str);
+                token = token_at(n++);
+            }
+
+            if (token.type == Token_Ellipsis) {
+                variadic = true;
+                params.push_back("__VA_ARGS__");
+            } else if (token.type == Token_Id) {
+                params.push_back(token.str);
+            } else {
+                throw errorf("expected a parameter name in macro '{}'", token, name.str);
+            }
+        }
+    }
+
+    uint32 body_begin = macro_tokens.size();
+    Macro macro = {body_begin, 0, (uint32)params.size(), function_like, variadic, false, true};
+    for (; n < line.size(); n++) {
+        auto param = std::find(params.begin(), params.end(), files.str(line[n]));
+        int32 index = line[n].type() == Token_Id and param != params.end() ? param - params.begin() : -1;
+        macro_tokens.push_back({line[n], index});
+    }
+    macro.body_end = macro_tokens.size();
+
+    for (uint32 k = macro.body_begin; k < macro.body_end; k++) {
+        Token_Type type = macro_tokens[k].token.type();
+        bool stringized = k + 1 < macro.body_end and macro_tokens[k + 1].param >= 0;
+        if (function_like and type == Token_Hash and !stringized)
+            throw errorf("'#' is not followed by a macro parameter", files.expand(macro_tokens[k].token));
+        if (type == Token_Hash_Paste and (k == macro.body_begin or k + 1 == macro.body_end))
+            throw errorf("'##' cannot be at either end of a macro", files.expand(macro_tokens[k].token));
+
+        macro.substituted = macro.substituted or macro_tokens[k].param >= 0 or type == Token_Hash_Paste or
+                            (function_like and type == Token_Hash);
+    }
+
+    Symbol symbol = symbols.intern(name.str);
+    macros.resize(symbols.names.size());
+    macros[symbol] = macro;
+    macro_name_types |= name.type;
+}
+
+// Include guards are defined empty
+void Preprocessor::define_macro(std::string_view name, Token_Type type)
+{
+    Symbol symbol = symbols.intern(name);
+    macros.resize(symbols.names.size());
+    macros[symbol] = {(uint32)macro_tokens.size(), (uint32)macro_tokens.size(), 0, false, false, false, true};
+    macro_name_types |= type;
+}
+
+bool Preprocessor::is_defined(std::string_view name) const
+{
+    Symbol symbol = symbols.find(name);
+    return symbol != Symbol_None and macros[symbol].defined;
+}
+
+// The replacement list is rescanned in place of the name, a function-like name not followed by '(' is left as
+// it is. The expansion hides the name, along with the names hidden for both the name and the ')'
+bool Preprocessor::expand_macro(Macro_Input *input, Expanded_Token name)
+{
+    if (!(name.token.type() & macro_name_types))
+        return false;
+    Symbol symbol = symbols.find(files.str(name.token));
+    if (symbol == Symbol_None or !macros[symbol].defined or hidesets.contains(name.hideset, symbol))
+        return false;
+
+    Macro macro = macros[symbol];
+    Expanded_Token paren = {};
+    if (!macro.function_like) {
+        push_expansion(input, macro, hidesets.insert(name.hideset, symbol), NULL);
+    } else if (next_input(input, &paren, true) and paren.token.type() == Token_Paren_Begin) {
+        next_input(input, &paren);
+        Macro_Arguments args = {};
+        Expanded_Token paren_end = read_arguments(input, macro, files.expand(name.token), &args);
+        uint32 hideset = hidesets.intersect(name.hideset, paren_end.hideset);
+        push_expansion(input, macro, hidesets.insert(hideset, symbol), &args);
+    } else {
+        return false;
+    }
+
+    expansion_count++;
+    return true;
+}
+
+// Reads up to the ')' closing the invocation, the commas nested in parentheses do not split the arguments and
+// the last parameter of a variadic macro takes the rest of them
+Expanded_Token Preprocessor::read_arguments(Macro_Input *input, const Macro &macro, Token name,
+                                            Macro_Arguments *args)
+{
+    Expanded_Token token = {};
+    args->bounds = {0};
+
+    for (int32 depth = 0;;) {
+        if (!next_input(input, &token) or token.token.type() & (Token_Eof | Token_Mask_Hash))
+            throw errorf("unterminated argument list invoking macro '{}'", name, name.str);
+
+        Token_Type type = token.token.type();
+        if (depth == 0 and type == Token_Paren_End)
+            break;
+        bool variadic_comma = macro.variadic and args->bounds.size() == macro.param_count;
+        if (depth == 0 and type == Token_Comma and !variadic_comma) {
+            args->bounds.push_back(args->tokens.size());
+            continue;
+        }
+
+        depth += (type == Token_Paren_Begin) - (type == Token_Paren_End);
+        args->tokens.push_back(token);
+    }
+    args->bounds.push_back(args->tokens.size());
+
+    // 'f()' passes no argument to a macro without parameters, the variadic arguments may be left out
+    if (macro.param_count == 0 and args->tokens.empty())
+        args->bounds.pop_back();
+    if (macro.variadic and args->bounds.size() == macro.param_count)
+        args->bounds.push_back(args->tokens.size());
+
+    size_t count = args->bounds.size() - 1;
+    if (count != macro.param_count)
+        throw errorf("macro '{}' takes {} arguments, {} given", name, name.str, macro.param_count, count);
+
+    args->expanded.resize(count);
+    args->is_expanded.resize(count);
+    return token;
+}
+
+// A replacement list without parameters, '#' or '##' is read in place. Otherwise a parameter is replaced by
+// its expanded argument, or by the argument as it is next to '#' and '##'. An empty operand of '##' leaves
+// the other one as it is
+void Preprocessor::push_expansion(Macro_Input *input, const Macro &macro, uint32 hideset,
+                                  Macro_Arguments *args)
+{
+    pop_read_frames(input);
+    if (!macro.substituted) {
+        input->frames.push_back({macro.body_begin, macro.body_begin, macro.body_end, hideset, false});
+        return;
+    }
+
+    std::vector<Expanded_Token> &out = input->substituted;
+    uint32 begin = out.size();
+    size_t operand = out.size();
+
+    for (uint32 n = macro.body_begin; n < macro.body_end; n++) {
+        Macro_Token body = macro_tokens[n];
+        Token_Type type = body.token.type();
+
+        if (type == Token_Hash_Paste) {
+            Macro_Token rhs = macro_tokens[++n];
+            Expanded_Token rhs_token = {rhs.token, 0};
+            std::span<const Expanded_Token> rhs_tokens = {&rhs_token, 1};
+            if (rhs.param >= 0)
+                rhs_tokens = (*args)[rhs.param];
+            bool has_lhs = out.size() > operand;
+
+            for (size_t k = 0; k < rhs_tokens.size(); k++) {
+                uint32 token_hideset = hidesets.merge(rhs_tokens[k].hideset, hideset);
+                if (k == 0 and has_lhs) {
+                    token_hideset = hidesets.merge(out.back().hideset, token_hideset);
+                    out.back() = {paste(out.back(), rhs_tokens[k]), token_hideset};
+                } else {
+                    out.push_back({rhs_tokens[k].token, token_hideset});
+                }
+            }
+            operand = has_lhs or !rhs_tokens.empty() ? out.size() - 1 : out.size();
+            continue;
+        }
+
+        operand = out.size();
+        if (type == Token_Hash and macro.function_like) {
+            out.push_back({stringize((*args)[macro_tokens[++n].param], body.token), hideset});
+        } else if (body.param >= 0) {
+            bool pasted = n + 1 < macro.body_end and macro_tokens[n + 1].token.type() == Token_Hash_Paste;
+            std::span<const Expanded_Token> arg = (*args)[body.param];
+            if (!pasted)
+                arg = expand_argument(args, body.param);
+            for (Expanded_Token token : arg)
+                out.push_back({token.token, hidesets.merge(token.hideset, hideset)});
+        } else {
+            out.push_back({body.token, hideset});
+        }
+    }
+
+    input->frames.push_back({begin, begin, (uint32)out.size(), 0, true});
+}
+
+// An argument is expanded on its own, a function-like name at its end is left to the rescan
+std::span<const Expanded_Token> Preprocessor::expand_argument(Macro_Arguments *args, int32 param)
+{
+    if (!args->is_expanded[param]) {
+        std::span<const Expanded_Token> arg = (*args)[param];
+        Macro_Input input = {{}, {arg.begin(), arg.end()}, NULL, NULL, 0, {}};
+        input.frames.push_back({0, 0, (uint32)arg.size(), 0, true});
+
+        for (Expanded_Token token = {}; next_input(&input, &token);) {
+            if (!expand_macro(&input, token))
+                args->expanded[param].push_back(token);
+        }
+        args->is_expanded[param] = true;
+    }
+    return args->expanded[param];
+}
+
+// Next token of the frames, then of the source for the input of a context. A token peeked from the source
+// stays in the lookahead until it is read
+bool Preprocessor::next_input(Macro_Input *input, Expanded_Token *token, bool peek)
+{
+    if (pop_read_frames(input)) {
+        Macro_Frame &frame = input->frames.back();
+        *token = frame.substituted ? input->substituted[frame.next]
+                                   : Expanded_Token{macro_tokens[frame.next].token, frame.hideset};
+        frame.next += !peek;
+        return true;
+    }
+
+    if (input->context == NULL)
+        return false;
+    if (!input->lookahead.type)
+        input->lookahead = next_token(input->context, syntax_map_c89(), input->skip_mask, input->record);
+    *token = {files.compact(input->lookahead), 0};
+    if (!peek)
+        input->lookahead = {};
+    return true;
+}
+
+// The spelling of the argument between quotes, with a space where its tokens were apart. The '"' and '\' of
+// the string and character literals are escaped
+Compact_Token Preprocessor::stringize(std::span<const Expanded_Token> arg, Compact_Token hash)
+{
+    std::string text = "\"";
+    for (size_t n = 0; n < arg.size(); n++) {
+        Compact_Token token = arg[n].token;
+        Compact_Token previous = n > 0 ? arg[n - 1].token : token;
+        if (n > 0 and (previous.file != token.file or previous.offset + previous.size != token.offset))
+            text += ' ';
+
+        for (char c : files.str(token)) {
+            if (token.type() & (Token_String | Token_Char) and (c == '"' or c == '\\'))
+                text += '\\';
+            text += c;
+        }
+    }
+    text += '"';
+    return scratch_token(text, hash);
+}
+
+Compact_Token Preprocessor::paste(Expanded_Token lhs, Expanded_Token rhs)
+{
+    return scratch_token(fmt::format("{}{}", files.str(lhs.token), files.str(rhs.token)), lhs.token);
+}
+
+// Appends the text to the scratch source and lexes it, the text has to make a single token. A scratch source
+// never grows past the capacity it was opened with, so the text of the tokens made before stays in place
+Compact_Token Preprocessor::scratch_token(std::string_view text, Compact_Token at)
+{
+    if (scratch_file < 0 or
+        files.files[scratch_file].text.size() + text.size() + 1 > files.files[scratch_file].text.capacity()) {
+        std::string scratch = {};
+        scratch.reserve(Max(Scratch_Capacity, text.size() + 1));
+        scratch_file = files.open(std::move(scratch), Token{"<macro expansion>"}).hash;
+    }
+
+    Source_File &file = files.files[scratch_file];
+    size_t offset = file.text.size();
+    file.text += text;
+    file.text += '\n';
+    file.source = file.text;
+
+    Source_Context context = {file.source, file.source.substr(offset, text.size()), &file.filepath,
+                              &file.line_starts, scratch_file};
+    Token token = {};
+    try {
+        token = scanner.tokenize(&context, syntax_map_c89(), 0);
+    } catch (const Error &) {
+        token = {};
+    }
+
+    if (!context.stream.empty() or !token.type or token.type & (Token_Mask_Skip | Token_Newline | Token_Eof))
+        throw errorf("'{}' is not a valid token", files.expand(at), text);
+    return files.compact(token);
+}
+
+// A header already included is skipped when its guard is defined, otherwise its tokens are output again while
+// no macro changed, the guards of the other headers aside. A header included again while it is still open
+// only has its guard known. The source of the header is read by the next steps
+void Preprocessor::process_include(const Include_File &file, Token token)
+{
+    if (!file.found)
+        throw errorf("file does not exists: {}", token, file.filepath.string());
+    if (dependency_keys.insert(file.key).second)
+        dependencies.push_back(file.filepath);
+
+    auto it = headers.find(file.key);
+    const Header *header = it != headers.end() ? &it->second : NULL;
+    for (auto open = open_sources.rbegin(); header == NULL and open != open_sources.rend(); open++) {
+        if (open->include and open->header_key == file.key)
+            header = &open->header;
+    }
+
+    if (header != NULL) {
+        bool once = header->guard.kind == Include_Guard_Once;
+        if (once or (header->guard.kind == Include_Guard_Macro and is_defined(header->guard.macro))) {
+            header_skip_count++;
+            return;
+        }
+        if (header->reusable and header->macro_change_count == macro_change_count) {
+            tokens.reserve(tokens.size() + header->tokens.size());
+            for (Compact_Token compact : header->tokens)
+                emit(compact);
+            header_reuse_count++;
+            return;
+        }
+    }
+
+    Source_Context context = files.open_file(file.filepath, token);
+    Include_Guard guard = detect_include_guard(context.source);
+    if (guard.kind == Include_Guard_Macro) {
+        if (is_defined(guard.macro)) {
+            header_skip_count++;
+            return;
+        }
+        if (!guard.define_in_body)
+            define_macro(guard.macro, keyword_type(guard.macro));
+        context.stream = context.source.substr(guard.body_begin, guard.body_end - guard.body_begin);
+    }
+
+    guarded_header_count += guard.kind != Include_Guard_None;
+    Open_Source &source = push_source(context, false, Token_Mask_Skip);
+    source.include = true;
+    source.header_key = file.key;
+    source.header = {guard, {}, 0, false};
+    source.header_begin = header_tokens.size();
+    source.guarded_count = guarded_header_count;
+    source.define_count = define_directive_count;
+    source.cached = token_cache.enabled() and token_cache.load(source.context.source, &source.record);
+    source.prefetched =
+        !source.cached and take_prefetched(file.filepath, source.context.source, &source.record);
+    if (token_cache.enabled() or source.prefetched)
+        source.input.record = &source.record;
+    include_depth++;
+}
+
+// Replays the next token of the record when it comes from the token cache, the scanned tokens are recorded.
+// A gap met by the replay is a group taken this time, it is scanned and the replay goes on from its end
+Token Preprocessor::next_token(Source_Context *context, Syntax_Map syntax_map, int128 skip_mask,
+                               Token_Record *record)
+{
+    const char *stream_end = context->stream.data() + context->stream.size();
+    if (record != NULL and record->replaying and record->gap_end == 0) {
+        qcc_assert(record->next < record->replay.size(), "token cache record is shorter than its replay");
+        Compact_Token compact = record->replay[record->next++];
+        if (compact.kind != Token_Kind_Gap) {
+            compact.file = context->hash;
+            context->stream = {context->source.data() + compact.offset + compact.size, stream_end};
+            return files.expand(compact);
+        }
+        record->gap_end = compact.offset + compact.size;
+        context->stream = {context->source.data() + compact.offset, stream_end};
+    }
+
+    Token token = scanner.tokenize(context, syntax_map, skip_mask);
+    uint32 offset = token.str.data() - context->source.data();
+    if (record != NULL and record->replaying) {
+        if (offset < record->gap_end)
+            return token;
+        // The token past the gap is replayed
+        auto it = std::lower_bound(record->replay.begin() + record->next, record->replay.end(), offset,
+                                   [](const Compact_Token &token, size_t end) { return token.offset < end; });
+        record->next = it - record->replay.begin();
+        record->gap_end = 0;
+        return next_token(context, syntax_map, skip_mask, record);
+    }
+    if (record != NULL)
+        record->tokens.push_back(Compact_Token{offset, (uint32)token.str.size(), 0, token_kind(token.type)});
+    return token;
+}
+
+// The operand keeps its delimiters. A '""' header is looked up in the directory of the including file and in
+// the one of the main file, then both kinds are looked up in the -I directories and the libraries. A '<>'
+// header falls back to the directory of the main file
+const Include_File &Preprocessor::resolve_include(std::string_view operand, const fs::path &directory)
+{
+    auto [it, inserted] = includes.try_emplace(fmt::format("{}\n{}", directory.string(), operand));
+    Include_File &file = it->second;
+    if (!inserted) {
+        include_cache_hit_count++;
+        return file;
+    }
+
+    fs::path name = {operand.begin() + 1, operand.end() - 1};
+    bool quoted = operand.starts_with('"');
+    if (quoted and (probe_include(directory, name, &file) or probe_include(cwd, name, &file)))
+        return file;
+    for (const fs::path &include_directory : include_directories) {
+        if (probe_include(include_directory, name, &file))
+            return file;
+    }
+    if (probe_include(Libs, name, &file) or (!quoted and probe_include(cwd, name, &file)))
+        return file;
+
+    file = {quoted ? directory / name : name, {}, false};
+    return file;
+}
+
+// One stat per candidate, the candidates missing from a listed directory cost a hash probe instead
+bool Preprocessor::probe_include(const fs::path &directory, const fs::path &name, Include_File *file)
+{
+    if (list_include_directories and !is_listed(directory, name))
+        return false;
+
+    fs::path filepath = directory / name;
+    struct stat status = {};
+    include_probe_count++;
+    if (stat(filepath.c_str(), &status) != 0 or !S_ISREG(status.st_mode))
+        return false;
+
+    *file = {std::move(filepath), {status.st_dev, status.st_ino}, true};
+    return true;
+}
+
+// Each component of the name is looked up in the listing of its parent, a directory is listed once
+bool Preprocessor::is_listed(fs::path directory, const fs::path &name)
+{
+    for (const fs::path &component : name) {
+        if (component == "." or component == ".." or component.has_root_directory()) {
+            directory /= component;
+            continue;
+        }
+
+        auto [it, inserted] = directory_listings.try_emplace(directory.string());
+        if (inserted) {
+            std::error_code error = {};
+            for (fs::directory_iterator entry{directory, error}; !error and entry != fs::directory_iterator{};
+                 entry.increment(error))
+                it->second.insert(entry->path().filename().string());
+        }
+        if (!it->second.contains(component.string()))
+            return false;
+        directory /= component;
+    }
+    return true;
+}
+
+// A path as make reads it in a rule
+static std::string make_escape(std::string_view path)
+{
+    std::string escaped = {};
+    for (char c : path) {
+        if (c == ' ' or c == '#')
+            escaped += '\\';
+        else if (c == '$')
+            escaped += '$';
+        escaped += c;
+    }
+    return escaped;
+}
+
+// Make rule of the target on the files opened, read once the sources are all processed
+std::string Preprocessor::dependency_rule(std::string_view target) const
+{
+    std::string rule = make_escape(target) + ":";
+    for (const fs::path &dependency : dependencies)
+        rule += fmt::format(" \\\n  {}", make_escape(dependency.string()));
+    return rule + "\n";
+}
+
 Source_Context Preprocessor::fs_open(fs::path filepath, Token token)
 {
     if (!fs::exists(filepath)) {
         throw errorf("file does not exists: {}", token, filepath.string());
     }
 
-    std::string file = fstream_to_str(std::fstream(filepath));
-    std::string_view source = files.emplace_back(std::move(file));
-
-    Source_Context context = {};
-    context.source = source;
-    context.stream = source;
-    context.filepath = &macros.emplace_back(token);
-    context.line = 0;
-    context.hash = (int64)&context;
-
-    return context;
+    return files.open_file(filepath, token);
 }
 
 } // namespace qcc
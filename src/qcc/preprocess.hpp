@@ -1,28 +1,178 @@
 #ifndef QCC_PREPROCESS_HPP
 #define QCC_PREPROCESS_HPP
 
+#include "macro.hpp"
+#include "scan/directive.hpp"
+#include "scan/file_table.hpp"
 #include "scan/scanner.hpp"
+#include "scan/token_cache.hpp"
+#include <atomic>
+#include <deque>
+#include <map>
+#include <set>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace qcc
 {
 
+// Tokens an include of the file produced, they are only kept and reused when the include opened no guarded
+// header and no macro changed since
+struct Header
+{
+    Include_Guard guard;
+    std::vector<Compact_Token> tokens;
+    size_t macro_change_count;
+    bool reusable;
+};
+
+// Where an include resolved to, the file is known by device and inode. A miss is resolved once too
+struct Include_File
+{
+    fs::path filepath;
+    std::pair<uint64, uint64> key;
+    bool found;
+};
+
+// Raw tokens of a file lexed ahead of the serial pass, replayed by the include that reads it
+struct Prefetched_File
+{
+    std::vector<Compact_Token> tokens;
+    size_t source_size;
+};
+
+// Raw tokens of a chunk of lines. The chunk is lexed from its first line onwards and stops at the first token
+// past its last line, where the following chunk has to start. Lines are the tokens that start a line outside
+// of a directive, the lexing of the chunk can be joined there
+struct Lexed_Chunk
+{
+    std::vector<Compact_Token> tokens;
+    std::vector<uint32> lines;
+    const char *next;
+};
+
+// An open conditional, taken once one of its groups was kept
+struct Conditional
+{
+    Token token;
+    bool taken;
+};
+
+// A source being read, the main file or an include. The input reads the context and the record the source
+// owns, or the ones of the caller. An include stores its header once its tokens are all out
+struct Open_Source
+{
+    Macro_Input input;
+    Source_Context context;
+    Token_Record record;
+    bool has_eof;
+    size_t conditional_count;
+    std::pair<uint64, uint64> header_key;
+    Header header;
+    size_t header_begin;
+    size_t guarded_count;
+    size_t define_count;
+    bool include;
+    bool cached;
+    bool prefetched;
+};
+
+struct Prefetch_Queue;
+
 struct Preprocessor
 {
     Scanner scanner;
     std::string filepath;
     fs::path cwd;
-    std::vector<Token> tokens;
-    std::vector<Token> macros;
-    std::vector<std::string> files;
+    // Output not pulled yet. The sources are read one step at a time, an include pushes its source and the
+    // tokens of the open includes are kept until the outermost one is read
+    std::vector<Compact_Token> tokens;
+    std::deque<Open_Source> open_sources;
+    size_t include_depth = 0;
+    std::vector<Compact_Token> header_tokens;
+    File_Table files;
     std::unordered_map<std::string_view, Source_Context> sources;
+    // Headers by device and inode
+    std::map<std::pair<uint64, uint64>, Header> headers;
+    size_t guarded_header_count = 0;
+    size_t header_reuse_count = 0;
+    size_t header_skip_count = 0;
+    // Directives that read or change the defines, a header holding one has its tokens lexed again
+    std::vector<Conditional> conditionals;
+    size_t define_directive_count = 0;
+    // Includes resolved by including directory and operand. Listed directories are read once, a file is then
+    // looked up in the listings and only the one found is opened
+    std::vector<fs::path> include_directories;
+    bool list_include_directories = false;
+    std::unordered_map<std::string, Include_File> includes;
+    std::unordered_map<std::string, std::unordered_set<std::string>> directory_listings;
+    size_t include_cache_hit_count = 0;
+    size_t include_probe_count = 0;
+    // Files the serial pass read, the main file first and each header once, in the order of their first
+    // include. A header is known by device and inode once it resolved
+    std::vector<fs::path> dependencies;
+    std::set<std::pair<uint64, uint64>> dependency_keys;
+    // Macros by the symbol of their name and the types of the names, keywords can be defined too. Replacement
+    // lists are ranges of the macro tokens, the text made by '#' and '##' goes to a scratch source
+    Symbol_Table symbols;
+    Hideset_Table hidesets;
+    std::vector<Macro> macros;
+    std::vector<Macro_Token> macro_tokens;
+    int128 macro_name_types = 0;
+    size_t macro_change_count = 0;
+    size_t expansion_count = 0;
+    int32 scratch_file = -1;
+    Token_Cache token_cache;
+    // Headers and the chunks of a large main file are lexed ahead by that many threads, the calling one
+    // included. Lexers only record raw tokens, they do not follow includes and stop at lex_end when set
+    size_t thread_count = std::thread::hardware_concurrency();
+    size_t chunk_size = 1 << 20;
+    bool lex_only = false;
+    const char *lex_end = NULL;
+    std::vector<uint32> line_tokens;
+    size_t chunk_relex_count = 0;
+    std::unordered_map<std::string, Prefetched_File> prefetched;
 
     Preprocessor(fs::path filepath);
 
     void process();
-    void process_context(Source_Context *context, bool has_eof = false, int128 skip_mask = Token_Mask_Skip);
-    void process_hash_token(Source_Context *context, Token hash);
+    void open_main();
+    bool pull();
+    void step();
+    void emit(Compact_Token token);
+    Open_Source &push_source(Source_Context context, bool has_eof, int128 skip_mask);
+    void close_source();
+    void prefetch(Source_Context main_context);
+    void prefetch_file(const fs::path &filepath, Prefetch_Queue *queue);
+    void queue_includes(Source_Context context, Prefetch_Queue *queue);
+    bool lex_chunks(Source_Context context, Token_Record *record);
+    void lex_chunk(Source_Context context, const char *begin, const char *end, Lexed_Chunk *chunk);
+    bool take_prefetched(const fs::path &filepath, std::string_view source, Token_Record *record) const;
+    void process_context(Source_Context *context, bool has_eof = false, int128 skip_mask = Token_Mask_Skip,
+                         Token_Record *record = NULL);
+    void process_hash_token(Source_Context *context, Token hash, Token_Record *record);
+    Token next_token(Source_Context *context, Syntax_Map syntax_map, int128 skip_mask, Token_Record *record);
+    void process_include(const Include_File &file, Token token);
+    void process_conditional(Source_Context *context, Token hash, Token_Record *record);
+    void skip_inactive_group(Source_Context *context, bool to_endif, Token_Record *record);
+    Token read_line(Source_Context *context, Token_Record *record, std::vector<Compact_Token> *line = NULL);
+    void define_macro(Token name, std::span<const Compact_Token> line);
+    void define_macro(std::string_view name, Token_Type type);
+    bool is_defined(std::string_view name) const;
+    bool expand_macro(Macro_Input *input, Expanded_Token name);
+    Expanded_Token read_arguments(Macro_Input *input, const Macro &macro, Token name, Macro_Arguments *args);
+    void push_expansion(Macro_Input *input, const Macro &macro, uint32 hideset, Macro_Arguments *args);
+    std::span<const Expanded_Token> expand_argument(Macro_Arguments *args, int32 param);
+    bool next_input(Macro_Input *input, Expanded_Token *token, bool peek = false);
+    Compact_Token stringize(std::span<const Expanded_Token> arg, Compact_Token hash);
+    Compact_Token paste(Expanded_Token lhs, Expanded_Token rhs);
+    Compact_Token scratch_token(std::string_view text, Compact_Token at);
+    const Include_File &resolve_include(std::string_view operand, const fs::path &directory);
+    bool probe_include(const fs::path &directory, const fs::path &name, Include_File *file);
+    bool is_listed(fs::path directory, const fs::path &name);
     Source_Context fs_open(fs::path filepath, Token token);
+    std::string dependency_rule(std::string_view target) const;
 
     Error errorf(std::string_view fmt, Token token, auto... args) const
     {
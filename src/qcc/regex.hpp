@@ -2,29 +2,88 @@
 #define QCC_REGEX_HPP
 
 #include "common.hpp"
+#include "regex/bit_nfa.hpp"
+#include "regex/lazy_dfa.hpp"
 #include "regex/match.hpp"
 #include "regex/node.hpp"
 #include "regex/parser.hpp"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
 
 namespace qcc::regex
 {
 
+// Compiled form of a Regex. Small graphs without priority cuts are simulated bit-parallel, the others run on
+// a Dfa built as they match
+struct Regex_Program
+{
+    Node_Graph graph;
+    Node *head;
+    Bit_Nfa bit_nfa;
+    Lazy_Dfa dfa;
+    Char_Set first;
+
+    Regex_Program(std::string_view src)
+    {
+        head = Parser{src, graph}.parse();
+        bit_nfa = Bit_Nfa{head};
+        if (!bit_nfa.ok)
+            dfa = Lazy_Dfa{head};
+        first = make_first_set(head);
+    }
+};
+
+// Constant-initialized from its source, the pattern is only parsed the first time it is used. Static tables
+// of regexes cost no startup work and no allocation for the patterns that are never matched
 struct Regex
 {
     std::string_view src;
-    Node *head;
-    Node_Arena arena;
+    mutable std::atomic<Regex_Program *> program;
+
+    constexpr Regex(std::string_view src) : src(src), program(NULL) {}
+    constexpr Regex(const char *src) : Regex(std::string_view{src}) {}
+    Regex(const Regex &) = delete;
 
-    Regex(std::string_view src) : src(src)
+    constexpr ~Regex()
     {
-        head = Parser{src, arena}.parse();
+        if (!std::is_constant_evaluated())
+            delete program.load();
     }
 
-    Regex(const char *src) : Regex(std::string_view{src}) {}
+    // Throws on a malformed pattern, the next call parses it again
+    const Regex_Program &compile() const
+    {
+        Regex_Program *compiled = program.load(std::memory_order_acquire);
+        if (compiled == NULL) {
+            std::unique_ptr<Regex_Program> made = std::make_unique<Regex_Program>(src);
+            if (program.compare_exchange_strong(compiled, made.get(), std::memory_order_acq_rel))
+                compiled = made.release();
+        }
+        return *compiled;
+    }
+
+    Regex_Program &compile()
+    {
+        return const_cast<Regex_Program &>(std::as_const(*this).compile());
+    }
 
     Match match(std::string_view expr) const
     {
-        return head != NULL ? Match{expr, head->submit(expr, 0)} : Match{expr, npos};
+        const Regex_Program &compiled = compile();
+        if (compiled.bit_nfa.ok)
+            return Match{expr, compiled.bit_nfa.match(expr)};
+        if (compiled.dfa.ok)
+            return Match{expr, compiled.dfa.match(expr).index};
+        return backtrack(expr);
+    }
+
+    // Reference matcher walking the node graph, kept for the graphs the Dfa cannot represent
+    Match backtrack(std::string_view expr) const
+    {
+        const Regex_Program &compiled = compile();
+        return compiled.head != NULL ? Match{expr, compiled.head->submit(expr, 0)} : Match{expr, npos};
     }
 
     Match match(auto begin, auto end) const
@@ -33,9 +92,24 @@ struct Regex
     }
 };
 
-inline regex::Regex operator""_rx(const char *src, size_t)
+template <size_t N>
+struct Regex_Literal
+{
+    char str[N];
+
+    constexpr Regex_Literal(const char (&src)[N])
+    {
+        std::copy_n(src, N, str);
+    }
+};
+
+// Each literal is parsed once, on its first evaluation
+template <Regex_Literal Src>
+const Regex &operator""_rx()
 {
-    return Regex{src};
+    static constinit Regex regex = {std::string_view{Src.str, sizeof(Src.str) - 1}};
+    regex.compile();
+    return regex;
 }
 
 } // namespace qcc::regex
@@ -0,0 +1,133 @@
+#include "bit_nfa.hpp"
+
+namespace qcc::regex
+{
+
+Bit_Nfa::Bit_Nfa(Node *head) : classes{}, class_count(0), start(0), eof_accept(0), ok(false)
+{
+    Nfa nfa = {head};
+    if (!nfa.ok)
+        return;
+
+    std::vector<uint32> positions = {};
+    std::vector<int32> bits(nfa.states.size(), -1);
+
+    for (uint32 id = 0; id < nfa.states.size(); id++) {
+        if (nfa.states[id].kind == Nfa_Consume) {
+            bits[id] = positions.size();
+            positions.push_back(id);
+        }
+    }
+    if (positions.size() >= Bit_Nfa_Positions)
+        return;
+
+    start = positions.size();
+    positions.push_back(nfa.starts[0]);
+
+    classes = nfa.byte_classes(&class_count);
+    std::vector<int32> representatives(class_count, -1);
+    for (int32 b = 0; b < 256; b++) {
+        if (representatives[classes[b]] < 0)
+            representatives[classes[b]] = b;
+    }
+
+    follow.assign(positions.size() * class_count, 0);
+    accept.assign(class_count, 0);
+
+    auto live_mask = [&](const std::vector<uint32> &consumers, int32 lookahead) -> uint64 {
+        uint64 mask = 0;
+        for (uint32 consumer : consumers) {
+            if (nfa.states[consumer].set[lookahead])
+                mask |= Bit(uint64, bits[consumer]);
+        }
+        return mask;
+    };
+
+    for (uint32 bit = 0; bit < positions.size(); bit++) {
+        std::span<const uint32> thread = {&positions[bit], 1};
+        std::vector<uint32> consumers = {};
+
+        if (nfa.closure(thread, -1, &consumers))
+            eof_accept |= Bit(uint64, bit);
+
+        for (size_t k = 0; k < class_count; k++) {
+            std::vector<uint32> cut_consumers = {};
+            consumers.clear();
+
+            bool match = nfa.closure(thread, representatives[k], &cut_consumers);
+            nfa.closure(thread, representatives[k], &consumers, false);
+
+            // A path of the thread is cut by its own match
+            uint64 mask = live_mask(consumers, representatives[k]);
+            if (live_mask(cut_consumers, representatives[k]) != mask)
+                return;
+
+            follow[bit * class_count + k] = mask;
+            if (match)
+                accept[k] |= Bit(uint64, bit);
+        }
+    }
+
+    // Over-approximates the pairs of positions live at the same time, a match of one must not cut the other
+    std::vector<uint64> coactive(positions.size(), 0);
+    coactive[start] = Bit(uint64, start);
+
+    for (bool changed = true; changed;) {
+        changed = false;
+
+        for (uint32 p = 0; p < positions.size(); p++) {
+            for (uint64 pairs = coactive[p]; pairs != 0; pairs &= pairs - 1) {
+                uint32 q = __builtin_ctzll(pairs);
+                if (q < p)
+                    continue;
+
+                for (size_t k = 0; k < class_count; k++) {
+                    uint64 next = follow[p * class_count + k] | follow[q * class_count + k];
+                    for (uint64 bits = next; bits != 0; bits &= bits - 1) {
+                        uint64 &mask = coactive[__builtin_ctzll(bits)];
+                        changed = changed or (mask | next) != mask;
+                        mask |= next;
+                    }
+                }
+            }
+        }
+    }
+
+    for (uint32 p = 0; p < positions.size(); p++) {
+        for (uint64 pairs = coactive[p] & ~Bit(uint64, p); pairs != 0; pairs &= pairs - 1) {
+            uint32 q = __builtin_ctzll(pairs);
+            for (size_t k = 0; k < class_count; k++) {
+                if ((accept[k] & Bit(uint64, p)) and follow[q * class_count + k] != 0)
+                    return;
+            }
+        }
+    }
+
+    ok = true;
+}
+
+size_t Bit_Nfa::match(std::string_view expr) const
+{
+    const uint8 *data = (const uint8 *)expr.data();
+    uint64 active = Bit(uint64, start);
+    size_t match = npos;
+
+    for (size_t n = 0;; n++) {
+        if (n >= expr.size())
+            return active & eof_accept ? n : match;
+
+        size_t k = classes[data[n]];
+        if (active & accept[k])
+            match = n;
+
+        uint64 next = 0;
+        for (uint64 bits = active; bits != 0; bits &= bits - 1)
+            next |= follow[__builtin_ctzll(bits) * class_count + k];
+
+        active = next;
+        if (active == 0)
+            return match;
+    }
+}
+
+} // namespace qcc::regex
@@ -0,0 +1,31 @@
+#ifndef QCC_REGEX_BIT_NFA_HPP
+#define QCC_REGEX_BIT_NFA_HPP
+
+#include "nfa.hpp"
+
+namespace qcc::regex
+{
+
+// One bit per consuming state plus one for the start
+constexpr size_t Bit_Nfa_Positions = 64;
+
+// Simulates the Nfa with a word holding every live position, the follow masks are resolved against the
+// lookahead byte class. A set of positions has no priority order, so this is only built when no thread can be
+// cut by a higher priority match: the first-match result is then the longest match
+struct Bit_Nfa
+{
+    std::array<uint8, 256> classes;
+    size_t class_count;
+    uint32 start;
+    std::vector<uint64> follow;
+    std::vector<uint64> accept;
+    uint64 eof_accept;
+    bool ok;
+
+    Bit_Nfa(Node *head = NULL);
+    size_t match(std::string_view expr) const;
+};
+
+} // namespace qcc::regex
+
+#endif
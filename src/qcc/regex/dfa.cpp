@@ -0,0 +1,90 @@
+#include "dfa.hpp"
+#include <map>
+
+namespace qcc::regex
+{
+
+Dfa::Dfa(Node *head, size_t state_limit) : Dfa(std::span<Node *const>{&head, 1}, state_limit) {}
+
+Dfa::Dfa(std::span<Node *const> heads, size_t state_limit) : start(Dfa_Dead), ok(false)
+{
+    Nfa nfa = {heads};
+    if (!nfa.ok or heads.size() >= (Bit(size_t, 32 - Dfa_Accept_Shift) - 1) or state_limit > Dfa_State_Mask)
+        return;
+
+    size_t class_count = 0;
+    std::array<uint8, 256> classes = nfa.byte_classes(&class_count);
+    std::array<int32, 256> representatives;
+    representatives.fill(-1);
+    for (int32 b = 0; b < 256; b++) {
+        if (representatives[classes[b]] < 0)
+            representatives[classes[b]] = b;
+    }
+
+    std::map<std::vector<uint32>, uint32> state_ids = {};
+    std::vector<std::vector<uint32>> states = {};
+
+    auto make_state = [&](std::vector<uint32> &&threads) -> uint32 {
+        auto [it, inserted] = state_ids.emplace(std::move(threads), states.size());
+        if (inserted)
+            states.push_back(it->first);
+        return it->second;
+    };
+
+    auto make_cell = [&](std::span<const uint32> threads, int32 lookahead) -> uint32 {
+        std::vector<uint32> next = {};
+        uint32 accept = nfa.step(threads, lookahead, &next);
+        return make_state(std::move(next)) | accept << Dfa_Accept_Shift;
+    };
+
+    make_state({});
+    start = make_state(std::vector<uint32>{nfa.starts});
+
+    std::vector<uint32> cells(class_count);
+
+    for (uint32 id = 1; id < states.size(); id++) {
+        if (states.size() > state_limit) {
+            table.clear();
+            return;
+        }
+
+        std::vector<uint32> threads = states[id];
+        for (size_t k = 0; k < class_count; k++)
+            cells[k] = make_cell(threads, representatives[k]);
+
+        table.resize((id + 1) * Dfa_Columns, Dfa_Dead);
+        uint32 *row = &table[id * Dfa_Columns];
+
+        for (size_t b = 0; b < 256; b++)
+            row[b] = cells[classes[b]];
+        row[Dfa_Eof] = make_cell(threads, -1);
+    }
+
+    ok = true;
+}
+
+Dfa_Match Dfa::match(std::string_view expr) const
+{
+    const uint8 *data = (const uint8 *)expr.data();
+    Dfa_Match match = {npos, -1};
+    uint32 state = start;
+
+    for (size_t n = 0;; n++) {
+        size_t column = n < expr.size() ? data[n] : Dfa_Eof;
+        uint32 cell = table[state * Dfa_Columns + column];
+
+        if (cell >> Dfa_Accept_Shift)
+            match = {n, (int32)(cell >> Dfa_Accept_Shift) - 1};
+        state = cell & Dfa_State_Mask;
+
+        if (state == Dfa_Dead)
+            return match;
+    }
+}
+
+size_t Dfa::state_count() const
+{
+    return table.size() / Dfa_Columns;
+}
+
+} // namespace qcc::regex
@@ -0,0 +1,43 @@
+#ifndef QCC_REGEX_DFA_HPP
+#define QCC_REGEX_DFA_HPP
+
+#include "nfa.hpp"
+
+namespace qcc::regex
+{
+
+// One column per byte and one for the end of input. A match is reported on the column that follows it, so
+// lookarounds can be resolved against the next character
+constexpr size_t Dfa_Columns = 257;
+constexpr size_t Dfa_Eof = 256;
+constexpr size_t Dfa_State_Limit = 4096;
+constexpr uint32 Dfa_Dead = 0;
+
+// A cell packs the next state with the matching pattern index plus one
+constexpr uint32 Dfa_Accept_Shift = 20;
+constexpr uint32 Dfa_State_Mask = Bit(uint32, Dfa_Accept_Shift) - 1;
+
+struct Dfa_Match
+{
+    size_t index;
+    int32 pattern;
+};
+
+// Each state is the ordered list of Nfa threads alive at this point, lower priority threads are dropped once
+// a thread matches. This keeps the first-match semantics of Node::submit() without any backtracking. With
+// several patterns the first listed pattern that matches wins, whatever its length
+struct Dfa
+{
+    std::vector<uint32> table;
+    uint32 start;
+    bool ok;
+
+    Dfa(Node *head = NULL, size_t state_limit = Dfa_State_Limit);
+    Dfa(std::span<Node *const> heads, size_t state_limit = Dfa_State_Limit);
+    Dfa_Match match(std::string_view expr) const;
+    size_t state_count() const;
+};
+
+} // namespace qcc::regex
+
+#endif
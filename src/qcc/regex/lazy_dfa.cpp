@@ -0,0 +1,111 @@
+#include "lazy_dfa.hpp"
+
+namespace qcc::regex
+{
+
+// The dead state and the start state are interned first after every flush
+constexpr uint32 Lazy_Dfa_Start = 1;
+constexpr size_t Lazy_Dfa_State_Overhead = 64;
+
+Lazy_Dfa::Lazy_Dfa(Node *head, size_t memory_budget)
+    : nfa{head}, classes{}, class_count(0), memory_budget(memory_budget),
+      cache(std::make_unique<Lazy_Dfa_Cache>()), ok(nfa.ok)
+{
+    if (!ok)
+        return;
+
+    classes = nfa.byte_classes(&class_count);
+    representatives.assign(class_count, -1);
+    for (int32 b = 0; b < 256; b++) {
+        if (representatives[classes[b]] < 0)
+            representatives[classes[b]] = b;
+    }
+
+    flush();
+    cache->flush_count = 0;
+}
+
+Dfa_Match Lazy_Dfa::match(std::string_view expr) const
+{
+    if (!ok)
+        return Dfa_Match{npos, -1};
+
+    std::lock_guard lock{cache->mutex};
+    const uint8 *data = (const uint8 *)expr.data();
+    size_t columns = class_count + 1;
+    Dfa_Match match = {npos, -1};
+    uint32 state = Lazy_Dfa_Start;
+
+    for (size_t n = 0;; n++) {
+        size_t column = n < expr.size() ? classes[data[n]] : class_count;
+        uint32 cell = cache->table[state * columns + column];
+        if (cell == Lazy_Dfa_Unknown)
+            cell = make_cell(state, column);
+
+        if (cell >> Dfa_Accept_Shift)
+            match = {n, (int32)(cell >> Dfa_Accept_Shift) - 1};
+        state = cell & Dfa_State_Mask;
+
+        if (state == Dfa_Dead)
+            return match;
+    }
+}
+
+size_t Lazy_Dfa::state_count() const
+{
+    std::lock_guard lock{cache->mutex};
+    return cache->states.size();
+}
+
+size_t Lazy_Dfa::flush_count() const
+{
+    std::lock_guard lock{cache->mutex};
+    return cache->flush_count;
+}
+
+uint32 Lazy_Dfa::make_state(std::vector<uint32> &&threads) const
+{
+    size_t size = threads.size();
+    auto [it, inserted] = cache->state_ids.emplace(std::move(threads), cache->states.size());
+
+    if (inserted) {
+        size_t columns = class_count + 1;
+        cache->states.push_back(&it->first);
+        cache->table.resize(cache->table.size() + columns, Lazy_Dfa_Unknown);
+        cache->memory += columns * sizeof(uint32) + size * sizeof(uint32) + Lazy_Dfa_State_Overhead;
+    }
+
+    return it->second;
+}
+
+// The row of the state is lost when the cache is flushed, the returned cell stays valid in the new cache
+uint32 Lazy_Dfa::make_cell(uint32 state, size_t column) const
+{
+    std::vector<uint32> threads = *cache->states[state];
+    std::vector<uint32> next = {};
+    int32 lookahead = column < class_count ? representatives[column] : -1;
+    uint32 accept = nfa.step(threads, lookahead, &next);
+
+    bool flushed = cache->memory > memory_budget or cache->states.size() > Dfa_State_Mask;
+    if (flushed)
+        flush();
+
+    uint32 cell = make_state(std::move(next)) | accept << Dfa_Accept_Shift;
+    if (!flushed)
+        cache->table[state * (class_count + 1) + column] = cell;
+    return cell;
+}
+
+void Lazy_Dfa::flush() const
+{
+    cache->state_ids.clear();
+    cache->states.clear();
+    cache->table.clear();
+    cache->memory = 0;
+    cache->flush_count++;
+
+    make_state({});
+    make_state(std::vector<uint32>{nfa.starts});
+}
+
+} // namespace qcc::regex
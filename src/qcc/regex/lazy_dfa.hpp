@@ -0,0 +1,50 @@
+#ifndef QCC_REGEX_LAZY_DFA_HPP
+#define QCC_REGEX_LAZY_DFA_HPP
+
+#include "dfa.hpp"
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace qcc::regex
+{
+
+constexpr size_t Lazy_Dfa_Memory_Budget = 256 << 10;
+constexpr uint32 Lazy_Dfa_Unknown = (uint32)-1;
+
+struct Lazy_Dfa_Cache
+{
+    std::mutex mutex;
+    std::map<std::vector<uint32>, uint32> state_ids;
+    std::vector<const std::vector<uint32> *> states;
+    std::vector<uint32> table;
+    size_t memory;
+    size_t flush_count;
+};
+
+// Same automaton as Dfa, but a cell is only computed the first time the match walks through it. Rows have one
+// column per byte class plus the end of input. The cache is flushed once its memory budget is exceeded, so a
+// pattern costs nothing until it is matched and never more than the budget
+struct Lazy_Dfa
+{
+    Nfa nfa;
+    std::array<uint8, 256> classes;
+    std::vector<int32> representatives;
+    size_t class_count;
+    size_t memory_budget;
+    std::unique_ptr<Lazy_Dfa_Cache> cache;
+    bool ok;
+
+    Lazy_Dfa(Node *head = NULL, size_t memory_budget = Lazy_Dfa_Memory_Budget);
+    Dfa_Match match(std::string_view expr) const;
+    size_t state_count() const;
+    size_t flush_count() const;
+
+    uint32 make_state(std::vector<uint32> &&threads) const;
+    uint32 make_cell(uint32 state, size_t column) const;
+    void flush() const;
+};
+
+} // namespace qcc::regex
+
+#endif
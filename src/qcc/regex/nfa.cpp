@@ -0,0 +1,287 @@
+#include "nfa.hpp"
+#include <unordered_map>
+
+namespace qcc::regex
+{
+
+Nfa::Nfa(Node *head) : Nfa(std::span<Node *const>{&head, 1}) {}
+
+Nfa::Nfa(std::span<Node *const> heads) : ok(true)
+{
+    for (Node *head : heads)
+        starts.push_back(push_graph(head));
+}
+
+uint32 Nfa::push_graph(Node *head)
+{
+    std::unordered_map<const Node *, std::pair<uint32, uint32>> node_states;
+    std::vector<Node *> nodes;
+    uint32 start = push_state(Nfa_Eps);
+
+    if (head == NULL) {
+        ok = false;
+        return start;
+    }
+
+    node_states[head] = {};
+    nodes.push_back(head);
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        for (Node *edge : nodes[i]->edges) {
+            if (node_states.emplace(edge, std::pair<uint32, uint32>{}).second)
+                nodes.push_back(edge);
+        }
+    }
+
+    // Each node owns a chain of states, the chain end inherits the node edges
+    for (Node *node : nodes) {
+        uint32 entry = push_node(node);
+        node_states[node] = {entry, (uint32)states.size() - 1};
+    }
+
+    for (Node *node : nodes) {
+        Nfa_State &exit = states[node_states[node].second];
+        exit.terminal = !node->has_edges();
+
+        for (Node *edge : node->edges)
+            exit.edges.push_back(node_states[edge].first);
+    }
+
+    states[start].edges.push_back(node_states[head].first);
+    return start;
+}
+
+uint32 Nfa::push_state(Nfa_Kind kind, Char_Set set)
+{
+    states.push_back(Nfa_State{kind, false, (uint32)starts.size(), set, {}});
+    return states.size() - 1;
+}
+
+uint32 Nfa::push_node(Node *node)
+{
+    const State &state = node->state;
+    Char_Set set = {};
+
+    switch (state.option) {
+    case Regex_Eps:
+        return push_state(Nfa_Eps);
+
+    case Regex_Any:
+        return push_state(Nfa_Consume, set.set());
+
+    case Regex_Not:
+        if (!make_lookaround_set(state.sequence, &set)) {
+            ok = false;
+            return push_state(Nfa_Fail);
+        }
+        return push_state(Nfa_Consume, ~set);
+
+    case Regex_Dash:
+        if (!make_lookaround_set(state.sequence, &set)) {
+            ok = false;
+            return push_state(Nfa_Fail);
+        }
+        return push_state(Nfa_Assert, set);
+
+    case Regex_Str: {
+        // An empty string still requires a character to be left
+        if (state.str.empty())
+            return push_state(Nfa_Assert, set.set());
+
+        uint32 entry = states.size();
+        for (char c : state.str) {
+            uint32 n = push_state(Nfa_Consume, Char_Set{}.set((uint8)c));
+            if (n != entry)
+                states[n - 1].edges.push_back(n);
+        }
+        return entry;
+    }
+
+    case Regex_Set:
+        for (char c : state.str)
+            set.set((uint8)c);
+        return push_state(Nfa_Consume, set);
+
+    case Regex_Scope:
+        for (int32 b = 0; b < 256; b++) {
+            char c = (char)b;
+            set[b] = state.range[0] <= c and c <= state.range[1];
+        }
+        return push_state(Nfa_Consume, set);
+
+    default:
+        return push_state(Nfa_Fail);
+    }
+}
+
+struct Closure_Frame
+{
+    uint32 state;
+    uint32 edge;
+};
+
+bool Nfa::closure(std::span<const uint32> items, int32 lookahead, std::vector<uint32> *consumers,
+                  bool cut) const
+{
+    std::vector<bool> visited(states.size(), false);
+    std::vector<Closure_Frame> stack = {};
+    bool match = false;
+
+    // Walks the edges in priority order, a terminal state matches and cuts every lower priority thread unless
+    // the whole closure is requested
+    for (uint32 item : items) {
+        stack.push_back(Closure_Frame{item, 0});
+
+        while (!stack.empty()) {
+            Closure_Frame &frame = stack.back();
+            const Nfa_State &state = states[frame.state];
+
+            if (frame.edge >= state.edges.size()) {
+                stack.pop_back();
+                if (state.terminal and cut)
+                    return true;
+                match = match or state.terminal;
+                continue;
+            }
+
+            uint32 edge = state.edges[frame.edge++];
+            if (visited[edge])
+                continue;
+            visited[edge] = true;
+
+            const Nfa_State &next = states[edge];
+            switch (next.kind) {
+            case Nfa_Eps:
+                stack.push_back(Closure_Frame{edge, 0});
+                break;
+
+            case Nfa_Assert:
+                if (lookahead >= 0 and next.set[lookahead])
+                    stack.push_back(Closure_Frame{edge, 0});
+                break;
+
+            case Nfa_Consume:
+                consumers->push_back(edge);
+                break;
+
+            default:
+                break;
+            }
+        }
+    }
+
+    return match;
+}
+
+// Threads are grouped by pattern in priority order, a match of one pattern discards the following ones.
+// Returns the matching pattern index plus one, or zero
+uint32 Nfa::step(std::span<const uint32> threads, int32 lookahead, std::vector<uint32> *next) const
+{
+    std::vector<uint32> consumers = {};
+
+    for (size_t i = 0, j = 0; i < threads.size(); i = j) {
+        uint32 pattern = states[threads[i]].pattern;
+        while (j < threads.size() and states[threads[j]].pattern == pattern)
+            j++;
+
+        consumers.clear();
+        bool match = closure(threads.subspan(i, j - i), lookahead, &consumers);
+
+        for (uint32 consumer : consumers) {
+            if (lookahead >= 0 and states[consumer].set[lookahead])
+                next->push_back(consumer);
+        }
+        if (match)
+            return pattern + 1;
+    }
+
+    return 0;
+}
+
+std::array<uint8, 256> Nfa::byte_classes(size_t *count) const
+{
+    std::array<uint8, 256> classes = {};
+    *count = 1;
+
+    // Refines the byte partition with every set, bytes of the same class are never told apart
+    for (const Nfa_State &state : states) {
+        if (state.kind != Nfa_Consume and state.kind != Nfa_Assert)
+            continue;
+
+        std::array<int16, 512> remap;
+        remap.fill(-1);
+        size_t refined = 0;
+
+        for (size_t b = 0; b < 256; b++) {
+            size_t key = classes[b] * 2 + state.set[b];
+            if (remap[key] < 0)
+                remap[key] = refined++;
+            classes[b] = remap[key];
+        }
+        *count = refined;
+    }
+
+    return classes;
+}
+
+// Lookarounds are compiled into the set of characters accepted by their sequence, this only works when the
+// sequence outcome is known after a single character
+bool make_lookaround_set(Node *head, Char_Set *set)
+{
+    Nfa nfa = {head};
+    if (!nfa.ok)
+        return false;
+
+    bool has_assert = false;
+    for (const Nfa_State &state : nfa.states)
+        has_assert = has_assert or state.kind == Nfa_Assert;
+
+    for (int32 b = 0; b < 256; b++) {
+        std::vector<uint32> consumers = {};
+
+        if (nfa.closure(nfa.starts, b, &consumers)) {
+            set->set(b);
+            continue;
+        }
+
+        bool unknown = false;
+        for (uint32 consumer : consumers) {
+            if (!nfa.states[consumer].set[b])
+                continue;
+
+            std::vector<uint32> next = {};
+            if (nfa.closure({&consumer, 1}, -1, &next)) {
+                set->set(b);
+                break;
+            }
+            unknown = unknown or has_assert or !next.empty();
+        }
+
+        if (unknown and !set->test(b))
+            return false;
+    }
+
+    return true;
+}
+
+// Bytes a match can start with, a graph the Nfa cannot represent may start with any byte
+Char_Set make_first_set(Node *head)
+{
+    Char_Set set = {};
+    Nfa nfa = {head};
+    if (!nfa.ok)
+        return set.set();
+
+    for (int32 b = 0; b < 256; b++) {
+        std::vector<uint32> consumers = {};
+        bool match = nfa.closure(nfa.starts, b, &consumers);
+
+        for (uint32 consumer : consumers)
+            match = match or nfa.states[consumer].set[b];
+        set[b] = match;
+    }
+
+    return set;
+}
+
+} // namespace qcc::regex
@@ -0,0 +1,58 @@
+#ifndef QCC_REGEX_NFA_HPP
+#define QCC_REGEX_NFA_HPP
+
+#include "node.hpp"
+#include <array>
+#include <bitset>
+#include <span>
+#include <vector>
+
+namespace qcc::regex
+{
+
+typedef std::bitset<256> Char_Set;
+
+enum Nfa_Kind : uint8
+{
+    Nfa_Eps,
+    Nfa_Consume,
+    Nfa_Assert,
+    Nfa_Fail,
+};
+
+struct Nfa_State
+{
+    Nfa_Kind kind;
+    // The node has no forward edge, it matches once every edge failed
+    bool terminal;
+    uint32 pattern;
+    Char_Set set;
+    std::vector<uint32> edges;
+};
+
+// Flattened form of one or more Node graphs, edges are kept in the same priority order as Node::submit().
+// Regex_Str is split into one state per character and lookarounds are only supported over single characters
+struct Nfa
+{
+    std::vector<Nfa_State> states;
+    std::vector<uint32> starts;
+    bool ok;
+
+    Nfa(Node *head);
+    Nfa(std::span<Node *const> heads);
+
+    bool closure(std::span<const uint32> items, int32 lookahead, std::vector<uint32> *consumers,
+                 bool cut = true) const;
+    uint32 step(std::span<const uint32> threads, int32 lookahead, std::vector<uint32> *next) const;
+    std::array<uint8, 256> byte_classes(size_t *count) const;
+    uint32 push_graph(Node *head);
+    uint32 push_state(Nfa_Kind kind, Char_Set set = {});
+    uint32 push_node(Node *node);
+};
+
+bool make_lookaround_set(Node *head, Char_Set *set);
+Char_Set make_first_set(Node *head);
+
+} // namespace qcc::regex
+
+#endif
@@ -1,4 +1,5 @@
 #include "node.hpp"
+#include <vector>
 
 namespace qcc::regex
 {
@@ -8,56 +9,52 @@ bool Node_Cmp::operator()(const Node *a, const Node *b) const
     return a->id < b->id;
 }
 
-Node::Node(State state) : state(state), id(0), edges() {}
+Node::Node(State state) : state(state), edges(), id(0) {}
 
-Node::Node(Option option) : state{.option = option}, id(0), edges() {}
+Node::Node(Option option) : state{.option = option}, edges(), id(0) {}
 
+struct Submit_Frame
+{
+    const Node *node;
+    size_t match;
+    size_t edge;
+};
+
+// Depth first walk of the edges with an explicit stack, a success is final since every caller returns it
+// unchanged and a frame whose failure would only forward its last edge failure is dropped before descending
 size_t Node::submit(std::string_view expr, size_t n) const
 {
-    size_t match = state.submit(expr, n);
+    std::vector<Submit_Frame> stack = {};
+    const Node *node = this;
 
-    if (match != npos) {
-        if (!has_edges() and match >= expr.size())
-            return match;
+    for (;;) {
+        size_t match = node->state.submit(expr, n);
 
-        for (const Node *edge : edges) {
-            size_t match_fwd = edge->submit(expr, match);
-            if (match_fwd != npos)
-                return match_fwd;
+        if (match != npos) {
+            if (!node->has_edges() and match >= expr.size())
+                return match;
+            stack.push_back(Submit_Frame{node, match, 0});
         }
 
-        if (!has_edges())
-            return match;
-    }
+        for (;;) {
+            if (stack.empty())
+                return npos;
 
-    return npos;
-}
+            Submit_Frame &frame = stack.back();
+            if (frame.edge < frame.node->edges.size()) {
+                node = frame.node->edges[frame.edge++];
+                n = frame.match;
 
-Node *Node::push(Node *node)
-{
-    node->map_sequence_ids(end()->id + 1);
-    return *edges.insert(node).first;
-}
+                if (frame.edge == frame.node->edges.size() and frame.node->has_edges())
+                    stack.pop_back();
+                break;
+            }
 
-Node *Node::merge(Node *node)
-{
-    node->map_sequence_ids(end()->id + 1);
-    return concat(node);
-}
-
-Node *Node::concat(Node *node)
-{
-    for (Node *member : members()) {
-        if (!member->has_edges())
-            member->edges.insert(node);
+            if (!frame.node->has_edges())
+                return frame.match;
+            stack.pop_back();
+        }
     }
-    return node;
-}
-
-void Node::map_sequence_ids(int base)
-{
-    for (Node *member : members())
-        member->id += base;
 }
 
 Node *Node::end()
@@ -72,7 +69,7 @@ Node *Node::end()
 
 Node *Node::max_edge() const
 {
-    return !edges.empty() ? *edges.rbegin() : NULL;
+    return !edges.empty() ? edges.back() : NULL;
 }
 
 bool Node::has_edges() const
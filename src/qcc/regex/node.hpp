@@ -1,9 +1,10 @@
 #ifndef QCC_REGEX_NODE_HPP
 #define QCC_REGEX_NODE_HPP
 
-#include "arena.hpp"
 #include "state.hpp"
 #include <set>
+#include <span>
+#include <vector>
 
 namespace qcc::regex
 {
@@ -14,30 +15,34 @@ struct Node_Cmp
 };
 
 using Node_Set = std::set<Node *, Node_Cmp>;
-using Node_Arena = Arena<Node, 256>;
 
+// Edges are a slice of the graph edge array, sorted by id
 struct Node
 {
     State state;
-    Node_Set edges;
+    std::span<Node *const> edges;
     int id;
 
     Node(State state);
     Node(Option option = Regex_Monostate);
     size_t submit(std::string_view expr, size_t n) const;
 
-    Node *push(Node *node);
-    Node *merge(Node *node);
-    Node *concat(Node *node);
     Node *end();
     Node *max_edge() const;
     bool has_edges() const;
 
-    void map_sequence_ids(int base);
     Node_Set &make_members(Node_Set &set);
     Node_Set members();
 };
 
+// Nodes of a parsed regex, each graph is contiguous in id order and the edges of every node are stored
+// back to back in a single array
+struct Node_Graph
+{
+    std::vector<Node> nodes;
+    std::vector<Node *> edges;
+};
+
 } // namespace qcc::regex
 
 #endif
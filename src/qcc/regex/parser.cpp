@@ -6,38 +6,74 @@
 namespace qcc::regex
 {
 
-Parser::Parser(std::string_view src, Node_Arena &arena) : src(src), arena(arena), token(src.end()) {}
+Parser::Parser(std::string_view src, Node_Graph &graph) : src(src), graph(graph), token(src.end()) {}
 
 Node *Parser::parse()
 {
-    for (token = src.begin(); token < src.end(); token++) {
-        Node *sequence = parse_new_token();
-        if (sequence != NULL) {
-            sequences.push_back(sequence);
+    token = src.begin();
+    Fragment fragment = parse_sequences(false);
+    if (fragment.nodes.empty())
+        return NULL;
+
+    uint32 head = make_graph(std::move(fragment));
+    return make_layout(head);
+}
+
+Fragment Parser::parse_sequences(bool nested)
+{
+    std::vector<Fragment> outer = std::move(sequences);
+    sequences.clear();
+
+    for (;; token++) {
+        skip_blank();
+        if (token >= src.end() or (nested and *token == '}'))
+            break;
+
+        Fragment sequence = parse_new_token();
+        if (!sequence.nodes.empty()) {
+            sequences.push_back(std::move(sequence));
         }
     }
 
-    for (size_t i = 1; i < sequences.size(); i++) {
-        sequences[0]->merge(sequences[i]);
+    if (nested and token >= src.end()) {
+        throw errorf("unmatched sequence brace, missing <}}> token");
+    }
+
+    Fragment fragment = {};
+    for (Fragment &sequence : sequences) {
+        concat(fragment, std::move(sequence));
+    }
+
+    sequences = std::move(outer);
+    return fragment;
+}
+
+void Parser::skip_blank()
+{
+    while (token < src.end()) {
+        switch (*token) {
+        case ' ':
+        case '\f':
+        case '\n':
+        case '\r':
+        case '\t':
+        case '\v':
+            token++;
+            break;
+
+        default:
+            return;
+        }
     }
-    return sequences.empty() ? NULL : sequences[0];
 }
 
-Node *Parser::parse_new_token()
+Fragment Parser::parse_new_token()
 {
+    skip_blank();
     if (token >= src.end())
-        return NULL;
+        return Fragment{};
 
     switch (*token) {
-    case ' ':
-    case '\f':
-    case '\n':
-    case '\r':
-    case '\t':
-    case '\v':
-        token++;
-        return parse_new_token();
-
     case '_':
         return parse_set(" \v\b\f\t");
     case 'a':
@@ -87,71 +123,46 @@ Node *Parser::parse_new_token()
     }
 }
 
-std::string_view Parser::parse_subsequence()
+std::pair<Fragment, Fragment> Parser::parse_binary_op(char op)
 {
-    int depth = 1;
-    const char *begin = token + 1;
-    const char *end = token + 1;
-
-    while (depth > 0 and end < src.end()) {
-        switch (*end) {
-        case '{':
-            depth++;
-            break;
-
-        case '}':
-            depth--;
-            break;
-        }
-        end++;
-    }
-
-    if (depth > 0) {
-        throw errorf("unmatched sequence brace, missing <}}> token");
-    }
-
-    token = end - 1;
-    return std::string_view{begin, end - 1};
-}
-
-std::pair<Node *, Node *> Parser::parse_binary_op(char op)
-{
-    return std::make_pair(parse_pre_op(op), parse_post_op(op));
+    Fragment a = parse_pre_op(op);
+    return std::make_pair(std::move(a), parse_post_op(op));
 }
 
-Node *Parser::parse_pre_op(char op)
+Fragment Parser::parse_pre_op(char op)
 {
     if (sequences.empty()) {
         throw errorf("missing pre-operand for <{:c}> operator", op);
     }
 
-    Node *sequence = sequences.back();
+    Fragment sequence = std::move(sequences.back());
     sequences.pop_back();
     return sequence;
 }
 
-Node *Parser::parse_post_op(char op)
+Fragment Parser::parse_post_op(char op)
 {
     token++;
-    Node *sequence = parse_new_token();
+    skip_blank();
+    Fragment sequence = token < src.end() and *token != '}' ? parse_new_token() : Fragment{};
 
-    if (!sequence) {
+    if (sequence.nodes.empty()) {
         throw errorf("missing post-operand for <{:c}> operator", op);
     }
     return sequence;
 }
 
-Node *Parser::parse_set(std::string_view set)
+Fragment Parser::parse_set(std::string_view set)
 {
-    return arena.emplace(State{
+    return make_fragment(push_node(State{
         .option = Regex_Set,
         .str = set,
-    });
+    }));
 }
 
 const Regex Scope_Format = "'[' ^ '-' ^ ']'";
 
-Node *Parser::parse_scope()
+Fragment Parser::parse_scope()
 {
     if (!Scope_Format.match(token, src.end())) {
         throw errorf("scope does not match the format '{:s}'", Scope_Format.src);
@@ -161,18 +172,18 @@ Node *Parser::parse_scope()
     char b = token[3];
     token = &token[4];
 
-    return arena.emplace(State{
+    return make_fragment(push_node(State{
         .option = Regex_Scope,
         .range = {a, b},
-    });
+    }));
 }
 
-Node *Parser::parse_any()
+Fragment Parser::parse_any()
 {
-    return arena.emplace(State{Regex_Any});
+    return make_fragment(push_node(State{Regex_Any}));
 }
 
-Node *Parser::parse_str(char quote)
+Fragment Parser::parse_str(char quote)
 {
     const char *begin = token + 1;
     const char *end = std::find(begin, src.end(), quote);
@@ -181,32 +192,33 @@ Node *Parser::parse_str(char quote)
         throw errorf("unmatched string quote, missing ending <{:c}> token", quote);
     }
 
-    return arena.emplace(State{
+    return make_fragment(push_node(State{
         .option = Regex_Str,
         .str = {begin, token = end},
-    });
+    }));
 }
 
-Node *Parser::parse_sequence()
+Fragment Parser::parse_sequence()
 {
-    Parser parser{parse_subsequence(), arena};
-    return parser.parse();
+    token++;
+    return parse_sequences(true);
 }
 
-Node *Parser::parse_dash()
+// Lookaround sequences are separate graphs with their own ids
+Fragment Parser::parse_dash()
 {
-    return arena.emplace(State{
-        .option = Regex_Dash,
-        .sequence = parse_post_op('/'),
-    });
+    uint32 sequence = make_graph(parse_post_op('/'));
+    uint32 node = push_node(State{Regex_Dash});
+    sequence_heads.emplace_back(node, sequence);
+    return make_fragment(node);
 }
 
-Node *Parser::parse_not()
+Fragment Parser::parse_not()
 {
-    return arena.emplace(State{
-        .option = Regex_Not,
-        .sequence = parse_post_op('!'),
-    });
+    uint32 sequence = make_graph(parse_post_op('!'));
+    uint32 node = push_node(State{Regex_Not});
+    sequence_heads.emplace_back(node, sequence);
+    return make_fragment(node);
 }
 
 // Control flow structures:
@@ -218,64 +230,170 @@ Node *Parser::parse_not()
 // x: none
 // >: edge
 
-Node *Parser::parse_or()
+Fragment Parser::parse_or()
 {
     //   > a
     // $
     //   > b
     auto [a, b] = parse_binary_op('|');
-    Node *sequence = arena.emplace(State{Regex_Eps});
-    sequence->push(a);
-    sequence->push(b);
+    Fragment sequence = make_fragment(push_node(State{Regex_Eps}));
+    sequence.exits.clear();
+
+    edges.emplace_back(sequence.head, a.head);
+    edges.emplace_back(sequence.head, b.head);
+    sequence.nodes.splice(sequence.nodes.end(), a.nodes);
+    sequence.nodes.splice(sequence.nodes.end(), b.nodes);
+    sequence.exits.splice(sequence.exits.end(), a.exits);
+    sequence.exits.splice(sequence.exits.end(), b.exits);
 
     return sequence;
 }
 
-Node *Parser::parse_quest()
+Fragment Parser::parse_quest()
 {
     //   > o
     // $
     //   > '$
-    Node *sequence = arena.emplace(Regex_Eps);
-    sequence->merge(parse_pre_op('?'));
-    sequence->push(arena.emplace(State{Regex_Eps}));
+    Fragment sequence = make_fragment(push_node(State{Regex_Eps}));
+    concat(sequence, parse_pre_op('?'));
+
+    uint32 eps = push_node(State{Regex_Eps});
+    edges.emplace_back(sequence.head, eps);
+    sequence.nodes.push_back(eps);
+    sequence.exits.push_back(eps);
 
     return sequence;
 }
 
-Node *Parser::parse_star()
+Fragment Parser::parse_star()
 {
     //   > o > $
     // $
     //   > $'
-    Node *sequence = arena.emplace(Regex_Eps);
-    sequence->merge(parse_pre_op('*'));
-    sequence->concat(sequence);
-    sequence->push(arena.emplace(State{Regex_Eps}));
+    Fragment sequence = make_fragment(push_node(State{Regex_Eps}));
+    concat(sequence, parse_pre_op('*'));
+    link(sequence.exits, sequence.head);
+
+    uint32 eps = push_node(State{Regex_Eps});
+    edges.emplace_back(sequence.head, eps);
+    sequence.nodes.push_back(eps);
+    sequence.exits.push_back(eps);
 
     return sequence;
 }
 
-Node *Parser::parse_plus()
+Fragment Parser::parse_plus()
 {
     // o > $ > o
-    Node *sequence = parse_pre_op('+');
-    return sequence->concat(sequence);
+    Fragment sequence = parse_pre_op('+');
+    link(sequence.exits, sequence.head);
+    return sequence;
 }
 
-Node *Parser::parse_wave()
+Fragment Parser::parse_wave()
 {
     //   > b
     // $
     //   > a > $
     //       > x
     auto [a, b] = parse_binary_op('~');
-    auto sequence = arena.emplace(Regex_Eps);
-    sequence->push(b);
-    sequence->push(a)->concat(sequence);
-    a->merge(arena.emplace(State{Regex_None}));
+    Fragment sequence = make_fragment(push_node(State{Regex_Eps}));
+    sequence.exits.clear();
+
+    edges.emplace_back(sequence.head, b.head);
+    edges.emplace_back(sequence.head, a.head);
+    link(a.exits, sequence.head);
+
+    uint32 none = push_node(State{Regex_None});
+    link(a.exits, none);
+    a.nodes.push_back(none);
+
+    sequence.nodes.splice(sequence.nodes.end(), b.nodes);
+    sequence.nodes.splice(sequence.nodes.end(), a.nodes);
+    sequence.exits.splice(sequence.exits.end(), b.exits);
+    sequence.exits.push_back(none);
 
     return sequence;
 }
 
+uint32 Parser::push_node(State state)
+{
+    nodes.push_back(Node{state});
+    return nodes.size() - 1;
+}
+
+Fragment Parser::make_fragment(uint32 node)
+{
+    return Fragment{node, {node}, {node}};
+}
+
+// The exits of the fragment get a forward edge to the next one and stop being exits
+void Parser::concat(Fragment &fragment, Fragment &&next)
+{
+    if (fragment.nodes.empty()) {
+        fragment = std::move(next);
+        return;
+    }
+
+    link(fragment.exits, next.head);
+    fragment.nodes.splice(fragment.nodes.end(), next.nodes);
+    fragment.exits = std::move(next.exits);
+}
+
+void Parser::link(std::list<uint32> &exits, uint32 node)
+{
+    for (uint32 exit : exits)
+        edges.emplace_back(exit, node);
+}
+
+// Numbers a finished graph, lookaround sequences are separate graphs with their own ids
+uint32 Parser::make_graph(Fragment &&fragment)
+{
+    int id = 0;
+    for (uint32 node : fragment.nodes) {
+        nodes[node].id = id++;
+        order.push_back(node);
+    }
+    return fragment.head;
+}
+
+// Moves the nodes to the graph with each graph contiguous in id order, the edges of a node are a sorted slice
+// of a single edge array
+Node *Parser::make_layout(uint32 head)
+{
+    std::vector<uint32> positions(nodes.size(), 0);
+    for (uint32 n = 0; n < order.size(); n++)
+        positions[order[n]] = n;
+
+    for (auto &[node, edge] : edges)
+        node = positions[node], edge = positions[edge];
+
+    std::vector<Node> &layout = graph.nodes;
+    layout.clear();
+    layout.reserve(order.size());
+    for (uint32 node : order)
+        layout.push_back(nodes[node]);
+
+    std::sort(edges.begin(), edges.end(), [&](std::pair<uint32, uint32> a, std::pair<uint32, uint32> b) {
+        return a.first != b.first ? a.first < b.first : layout[a.second].id < layout[b.second].id;
+    });
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    graph.edges.clear();
+    graph.edges.reserve(edges.size());
+    for (auto [node, edge] : edges)
+        graph.edges.push_back(&layout[edge]);
+
+    for (size_t begin = 0, end = 0; begin < edges.size(); begin = end) {
+        while (end < edges.size() and edges[end].first == edges[begin].first)
+            end++;
+        layout[edges[begin].first].edges = {&graph.edges[begin], end - begin};
+    }
+
+    for (auto [node, sequence] : sequence_heads)
+        layout[positions[node]].state.sequence = &layout[positions[sequence]];
+
+    return &layout[positions[head]];
+}
+
 } // namespace qcc::regex
@@ -4,40 +4,62 @@
 #include "node.hpp"
 #include "state.hpp"
 #include <fmt/format.h>
+#include <list>
 #include <vector>
 
 namespace qcc::regex
 {
 
+// Graph under construction, nodes are listed in their final id order and exits are the nodes without a
+// forward edge yet
+struct Fragment
+{
+    uint32 head;
+    std::list<uint32> nodes;
+    std::list<uint32> exits;
+};
+
 struct Parser
 {
     std::string_view src;
-    Node_Arena &arena;
+    Node_Graph &graph;
     const char *token;
-    std::vector<Node *> sequences;
+    std::vector<Fragment> sequences;
+    std::vector<Node> nodes;
+    std::vector<uint32> order;
+    std::vector<std::pair<uint32, uint32>> edges;
+    std::vector<std::pair<uint32, uint32>> sequence_heads;
 
-    Parser(std::string_view src, Node_Arena &arena);
+    Parser(std::string_view src, Node_Graph &graph);
     Node *parse();
 
-    Node *parse_new_token();
-    std::string_view parse_subsequence();
-
-    std::pair<Node *, Node *> parse_binary_op(char op);
-    Node *parse_pre_op(char op);
-    Node *parse_post_op(char op);
-
-    Node *parse_set(std::string_view set);
-    Node *parse_scope();
-    Node *parse_any();
-    Node *parse_str(char quote);
-    Node *parse_sequence();
-    Node *parse_dash();
-    Node *parse_not();
-    Node *parse_or();
-    Node *parse_quest();
-    Node *parse_star();
-    Node *parse_plus();
-    Node *parse_wave();
+    Fragment parse_sequences(bool nested);
+    Fragment parse_new_token();
+    void skip_blank();
+
+    std::pair<Fragment, Fragment> parse_binary_op(char op);
+    Fragment parse_pre_op(char op);
+    Fragment parse_post_op(char op);
+
+    Fragment parse_set(std::string_view set);
+    Fragment parse_scope();
+    Fragment parse_any();
+    Fragment parse_str(char quote);
+    Fragment parse_sequence();
+    Fragment parse_dash();
+    Fragment parse_not();
+    Fragment parse_or();
+    Fragment parse_quest();
+    Fragment parse_star();
+    Fragment parse_plus();
+    Fragment parse_wave();
+
+    uint32 push_node(State state);
+    Fragment make_fragment(uint32 node);
+    void concat(Fragment &fragment, Fragment &&next);
+    void link(std::list<uint32> &exits, uint32 node);
+    uint32 make_graph(Fragment &&fragment);
+    Node *make_layout(uint32 head);
 
     Error errorf(std::string_view fmt, auto... args) const
     {
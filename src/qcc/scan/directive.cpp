@@ -0,0 +1,216 @@
+#include "directive.hpp"
+#include <cctype>
+
+namespace qcc
+{
+
+static bool is_blank(char c)
+{
+    return c == ' ' or c == '\v' or c == '\b' or c == '\f' or c == '\t' or c == '\r';
+}
+
+static bool is_identifier(char c)
+{
+    return std::isalnum((uint8)c) or c == '_';
+}
+
+static size_t skip_blanks(std::string_view source, size_t i)
+{
+    while (i < source.size() and is_blank(source[i]))
+        i++;
+    return i;
+}
+
+static size_t line_end(std::string_view source, size_t i)
+{
+    size_t end = source.find('\n', i);
+    return end != npos ? end : source.size();
+}
+
+// First character that is not a blank, a newline or part of a comment
+size_t skip_blank_lines(std::string_view source, size_t i)
+{
+    while (i < source.size()) {
+        if (is_blank(source[i]) or source[i] == '\n') {
+            i++;
+        } else if (source.substr(i, 2) == "//") {
+            i = line_end(source, i);
+        } else if (source.substr(i, 2) == "/*") {
+            size_t end = source.find("*/", i + 2);
+            if (end == npos)
+                return i;
+            i = end + 2;
+        } else {
+            break;
+        }
+    }
+    return i;
+}
+
+// Name of the directive of the line starting at i and the end of its line, empty when the line is not one
+std::string_view directive_name(std::string_view source, size_t i, size_t *end)
+{
+    *end = line_end(source, i);
+    i = skip_blanks(source, i);
+    if (i >= *end or source[i] != '#')
+        return {};
+
+    i = skip_blanks(source, i + 1);
+    size_t name_end = i;
+    while (name_end < *end and is_identifier(source[name_end]))
+        name_end++;
+    return source.substr(i, name_end - i);
+}
+
+// Identifier following the directive name on the line [i, end)
+static std::string_view directive_operand(std::string_view source, size_t i, size_t end)
+{
+    i = source.find('#', i) + 1;
+    i = skip_blanks(source, i);
+    while (i < end and is_identifier(source[i]))
+        i++;
+
+    i = skip_blanks(source, i);
+    size_t operand_end = i;
+    while (operand_end < end and is_identifier(source[operand_end]))
+        operand_end++;
+    return source.substr(i, operand_end - i);
+}
+
+// Filepath of the '#include' line [i, end) with its '""' or '<>' delimiters, empty when it has none
+std::string_view include_operand(std::string_view source, size_t i, size_t end)
+{
+    i = source.find('#', i) + 1;
+    i = skip_blanks(source, i);
+    while (i < end and is_identifier(source[i]))
+        i++;
+
+    i = skip_blanks(source, i);
+    if (i >= end or (source[i] != '"' and source[i] != '<'))
+        return {};
+
+    size_t operand_end = source.find(source[i] == '"' ? '"' : '>', i + 1);
+    if (operand_end >= end)
+        return {};
+    return source.substr(i, operand_end + 1 - i);
+}
+
+// End of the string or character literal opening at i, a literal left open ends with its line
+static size_t literal_end(std::string_view source, size_t i)
+{
+    char delimiter = source[i];
+    for (i++; i < source.size() and source[i] != delimiter and source[i] != '\n'; i++) {
+        if (source[i] == '\\')
+            i++;
+    }
+    return std::min(i, source.size());
+}
+
+// Start of the line of the '#else', '#elif' or '#endif' closing the group that starts at i, or of the
+// '#endif' only. Nested conditionals are skipped whole, the text in between is never tokenized: only a '#'
+// starting a line is looked at, and the comments and literals are jumped over so a directive or a comment
+// inside one is not taken
+size_t skip_inactive_group(std::string_view source, size_t i, bool to_endif)
+{
+    int32 depth = 0;
+
+    for (i = source.find_first_of("#/\"'", i); i < source.size(); i = source.find_first_of("#/\"'", i + 1)) {
+        if (source[i] == '"' or source[i] == '\'') {
+            i = literal_end(source, i);
+            continue;
+        }
+        if (source[i] == '/') {
+            if (source.substr(i, 2) == "//") {
+                i = line_end(source, i);
+            } else if (source.substr(i, 2) == "/*") {
+                size_t end = source.find("*/", i + 2);
+                if (end == npos)
+                    return source.size();
+                i = end + 1;
+            }
+            continue;
+        }
+
+        size_t line = i;
+        while (line > 0 and is_blank(source[line - 1]))
+            line--;
+        if (line > 0 and source[line - 1] != '\n')
+            continue;
+
+        size_t end = 0;
+        std::string_view name = directive_name(source, line, &end);
+        if (name == "if" or name == "ifdef" or name == "ifndef") {
+            depth++;
+        } else if (name == "endif") {
+            if (depth-- == 0)
+                return line;
+        } else if (depth == 0 and !to_endif and (name == "else" or name == "elif")) {
+            return line;
+        }
+        i = end;
+    }
+
+    return source.size();
+}
+
+// True when only blanks and comments are left on the line [i, end), a comment running past the line is not
+static bool is_blank_rest(std::string_view source, size_t i, size_t end)
+{
+    for (i = skip_blanks(source, i); i < end; i = skip_blanks(source, i)) {
+        if (source.substr(i, 2) == "//")
+            return true;
+        if (source.substr(i, 2) != "/*")
+            return false;
+
+        size_t comment_end = source.find("*/", i + 2);
+        if (comment_end == npos or comment_end >= end)
+            return false;
+        i = comment_end + 2;
+    }
+    return true;
+}
+
+// Line oriented, only the lines starting with '#' are looked at past the guard: the whole file wrapped in
+// '#ifndef X' '#define X' ... '#endif' with only comments outside. '#pragma once' is left to the serial pass,
+// which only runs it in an active group
+Include_Guard detect_include_guard(std::string_view source)
+{
+    Include_Guard guard = {Include_Guard_None, {}, 0, source.size(), false};
+
+    size_t i = skip_blank_lines(source, 0);
+    size_t end = 0;
+    if (directive_name(source, i, &end) != "ifndef")
+        return guard;
+    std::string_view macro = directive_operand(source, i, end);
+
+    i = skip_blank_lines(source, end);
+    if (macro.empty() or directive_name(source, i, &end) != "define")
+        return guard;
+    std::string_view defined = directive_operand(source, i, end);
+    if (defined != macro)
+        return guard;
+
+    // A define with parameters or a replacement list is read by the serial pass like any other
+    size_t defined_end = defined.data() + defined.size() - source.data();
+    bool define_in_body = !is_blank_rest(source, defined_end, end);
+    size_t body_begin = define_in_body ? i : end;
+
+    for (int32 depth = 1; end < source.size();) {
+        i = end + 1;
+        std::string_view name = directive_name(source, i, &end);
+
+        if (name == "if" or name == "ifdef" or name == "ifndef") {
+            depth++;
+        } else if (depth == 1 and (name == "else" or name == "elif")) {
+            return guard;
+        } else if (name == "endif" and --depth == 0) {
+            if (skip_blank_lines(source, end) != source.size())
+                return guard;
+            return Include_Guard{Include_Guard_Macro, macro, body_begin, i, define_in_body};
+        }
+    }
+
+    return guard;
+}
+
+} // namespace qcc
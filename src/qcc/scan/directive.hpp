@@ -0,0 +1,36 @@
+#ifndef QCC_DIRECTIVE_HPP
+#define QCC_DIRECTIVE_HPP
+
+#include "common.hpp"
+
+namespace qcc
+{
+
+enum Include_Guard_Kind : uint8
+{
+    Include_Guard_None,
+    Include_Guard_Macro,
+    Include_Guard_Once,
+};
+
+// The body of a macro guard is the text between the '#define' line and the closing '#endif'. The body starts
+// at the '#define' line when the macro takes parameters or a replacement list, the line then defines it.
+// '#pragma once' is only known once the serial pass read the header
+struct Include_Guard
+{
+    Include_Guard_Kind kind;
+    std::string_view macro;
+    size_t body_begin;
+    size_t body_end;
+    bool define_in_body;
+};
+
+size_t skip_blank_lines(std::string_view source, size_t i);
+std::string_view directive_name(std::string_view source, size_t i, size_t *end);
+std::string_view include_operand(std::string_view source, size_t i, size_t end);
+size_t skip_inactive_group(std::string_view source, size_t i, bool to_endif);
+Include_Guard detect_include_guard(std::string_view source);
+
+} // namespace qcc
+
+#endif
@@ -0,0 +1,161 @@
+#include "file_table.hpp"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace qcc
+{
+
+Source_Mapping::~Source_Mapping()
+{
+    if (data != NULL)
+        munmap(data, size);
+}
+
+// Maps the file followed by the '\n' that fstream_to_str() appends and a '\0' sentinel. Both land in the zero
+// filled tail of the last page of the file or in the anonymous pages reserved after it
+static bool map_source(const fs::path &filepath, Source_Mapping *mapping, size_t *size)
+{
+    int fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat status = {};
+    if (fstat(fd, &status) != 0 or !S_ISREG(status.st_mode) or (uint64)status.st_size >= UINT32_MAX) {
+        close(fd);
+        return false;
+    }
+
+    *size = status.st_size;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t reserved = Round_Up(*size + 2, page);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    char *data = (char *)mmap(NULL, reserved, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+    bool mapped = data != MAP_FAILED;
+    if (mapped and *size != 0)
+        mapped = mmap(data, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED;
+    close(fd);
+
+    if (!mapped) {
+        if (data != MAP_FAILED)
+            munmap(data, reserved);
+        return false;
+    }
+
+    data[*size] = '\n';
+    mprotect(data, reserved, PROT_READ);
+    mapping->data = data;
+    mapping->size = reserved;
+    return true;
+}
+
+Source_Context File_Table::open(std::string &&text, Token filepath)
+{
+    qcc_assert(text.size() < UINT32_MAX, "source file is too large");
+    Source_File &file = files.emplace_back();
+    file.text = std::move(text);
+    file.source = file.text;
+    file.filepath = filepath;
+    return make_context(file);
+}
+
+// Falls back to reading the file when it cannot be mapped, a pipe for instance
+Source_Context File_Table::open_file(const fs::path &filepath, Token token)
+{
+    Source_File &file = files.emplace_back();
+    size_t size = 0;
+
+    if (map_source(filepath, &file.mapping, &size)) {
+        file.source = std::string_view{(const char *)file.mapping.data, size + 1};
+    } else {
+        file.text = fstream_to_str(std::fstream(filepath));
+        qcc_assert(file.text.size() < UINT32_MAX, "source file is too large");
+        file.source = file.text;
+    }
+
+    file.filepath = token;
+    file.directory = filepath.parent_path();
+    return make_context(file);
+}
+
+Source_Context File_Table::make_context(Source_File &file)
+{
+    qcc_assert(files.size() <= UINT16_MAX + 1, "too many source files");
+    scan_line_starts(file.source, &file.line_starts);
+
+    Source_Context context = {};
+    context.source = file.source;
+    context.stream = file.source;
+    context.filepath = &file.filepath;
+    context.line_starts = &file.line_starts;
+    context.hash = files.size() - 1;
+
+    return context;
+}
+
+// A view of the source of another table, which keeps the text and the mapping
+void File_Table::share(const Source_File &file, std::string_view source)
+{
+    Source_File &view = files.emplace_back();
+    view.source = source;
+    view.filepath = file.filepath;
+    view.directory = file.directory;
+    view.line_starts = file.line_starts;
+}
+
+Compact_Token File_Table::compact(Token token) const
+{
+    const Source_File &file = files[token.context.hash];
+
+    Compact_Token compact = {};
+    compact.offset = token.str.data() - file.source.data();
+    compact.size = token.str.size();
+    compact.file = token.context.hash;
+    compact.kind = token_kind(token.type);
+    return compact;
+}
+
+Token File_Table::expand(Compact_Token token) const
+{
+    const Source_File &file = files[token.file];
+    std::string_view source = file.source;
+
+    Token expanded = {};
+    expanded.str = source.substr(token.offset, token.size);
+    expanded.type = token.type();
+    expanded.ok = true;
+    expanded.context.source = source;
+    expanded.context.stream = source.substr(token.offset);
+    expanded.context.filepath = &file.filepath;
+    expanded.context.line_starts = &file.line_starts;
+    expanded.context.hash = token.file;
+    expanded.type_str = token_type_str(expanded.type);
+    return expanded;
+}
+
+std::string_view File_Table::str(Compact_Token token) const
+{
+    return std::string_view{files[token.file].source.data() + token.offset, token.size};
+}
+
+// Zero based line and column, only computed when a diagnostic needs them. A context without line starts
+// counts the newlines before the character
+Source_Position source_position(const Source_Context &context, const char *at)
+{
+    uint32 offset = at - context.source.data();
+
+    if (context.line_starts == NULL) {
+        std::string_view before = context.source.substr(0, offset);
+        int32 line = std::count(before.begin(), before.end(), '\n');
+        return Source_Position{line, (int32)(offset - (before.rfind('\n') + 1))};
+    }
+
+    const std::vector<uint32> &line_starts = *context.line_starts;
+    size_t line = std::upper_bound(line_starts.begin(), line_starts.end(), offset) - line_starts.begin() - 1;
+    return Source_Position{(int32)line, (int32)(offset - line_starts[line])};
+}
+
+} // namespace qcc
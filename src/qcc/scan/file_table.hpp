@@ -0,0 +1,56 @@
+#ifndef QCC_FILE_TABLE_HPP
+#define QCC_FILE_TABLE_HPP
+
+#include "kernel.hpp"
+#include "token.hpp"
+#include <deque>
+
+namespace qcc
+{
+
+struct Source_Mapping
+{
+    void *data = NULL;
+    size_t size = 0;
+
+    Source_Mapping() = default;
+    Source_Mapping(const Source_Mapping &) = delete;
+    ~Source_Mapping();
+};
+
+// The source is either the text of the file or a view into its mapping, and is followed by a '\0' sentinel
+struct Source_File
+{
+    std::string text;
+    Source_Mapping mapping;
+    std::string_view source;
+    Token filepath;
+    fs::path directory;
+    std::vector<uint32> line_starts;
+};
+
+struct Source_Position
+{
+    int32 line;
+    int32 column;
+};
+
+// Sources of a translation unit, the hash of a context opened here is the file id of its compact tokens
+struct File_Table
+{
+    std::deque<Source_File> files;
+
+    Source_Context open(std::string &&text, Token filepath);
+    Source_Context open_file(const fs::path &filepath, Token token);
+    Source_Context make_context(Source_File &file);
+    void share(const Source_File &file, std::string_view source);
+    Compact_Token compact(Token token) const;
+    Token expand(Compact_Token token) const;
+    std::string_view str(Compact_Token token) const;
+};
+
+Source_Position source_position(const Source_Context &context, const char *at);
+
+} // namespace qcc
+
+#endif
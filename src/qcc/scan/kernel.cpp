@@ -0,0 +1,240 @@
+#include "kernel.hpp"
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define QCC_SCAN_X86
+#endif
+
+namespace qcc
+{
+
+static bool is_blank(char c)
+{
+    return c == ' ' or c == '\v' or c == '\b' or c == '\f' or c == '\t';
+}
+
+static size_t find_blank_end_scalar(const char *s, size_t i, size_t n)
+{
+    while (i < n and is_blank(s[i]))
+        i++;
+    return i;
+}
+
+static size_t find_any_scalar(const char *s, size_t i, size_t n, char a, char b, char c)
+{
+    while (i < n and s[i] != a and s[i] != b and s[i] != c)
+        i++;
+    return i;
+}
+
+#ifdef QCC_SCAN_X86
+
+static size_t find_blank_end_sse2(const char *s, size_t i, size_t n)
+{
+    const __m128i space = _mm_set1_epi8(' '), vtab = _mm_set1_epi8('\v'), backspace = _mm_set1_epi8('\b');
+    const __m128i feed = _mm_set1_epi8('\f'), tab = _mm_set1_epi8('\t');
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i blank = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, vtab)),
+                                     _mm_or_si128(_mm_cmpeq_epi8(v, backspace), _mm_cmpeq_epi8(v, feed)));
+        uint32 mask = ~_mm_movemask_epi8(_mm_or_si128(blank, _mm_cmpeq_epi8(v, tab))) & 0xffff;
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return find_blank_end_scalar(s, i, n);
+}
+
+static size_t find_any_sse2(const char *s, size_t i, size_t n, char a, char b, char c)
+{
+    const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b), vc = _mm_set1_epi8(c);
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i any = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+                                   _mm_cmpeq_epi8(v, vc));
+        uint32 mask = _mm_movemask_epi8(any);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return find_any_scalar(s, i, n, a, b, c);
+}
+
+__attribute__((target("avx2"))) static size_t find_blank_end_avx2(const char *s, size_t i, size_t n)
+{
+    const __m256i space = _mm256_set1_epi8(' '), vtab = _mm256_set1_epi8('\v');
+    const __m256i backspace = _mm256_set1_epi8('\b'), feed = _mm256_set1_epi8('\f');
+    const __m256i tab = _mm256_set1_epi8('\t');
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i blank =
+            _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, vtab)),
+                            _mm256_or_si256(_mm256_cmpeq_epi8(v, backspace), _mm256_cmpeq_epi8(v, feed)));
+        uint32 mask = ~(uint32)_mm256_movemask_epi8(_mm256_or_si256(blank, _mm256_cmpeq_epi8(v, tab)));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return find_blank_end_sse2(s, i, n);
+}
+
+__attribute__((target("avx2"))) static size_t find_any_avx2(const char *s, size_t i, size_t n, char a, char b,
+                                                            char c)
+{
+    const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b), vc = _mm256_set1_epi8(c);
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i any = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)),
+                                      _mm256_cmpeq_epi8(v, vc));
+        uint32 mask = _mm256_movemask_epi8(any);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return find_any_sse2(s, i, n, a, b, c);
+}
+
+#endif
+
+static Scan_Isa supported_scan_isa()
+{
+#ifdef QCC_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return Scan_Isa_Avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return Scan_Isa_Sse2;
+#endif
+    return Scan_Isa_Scalar;
+}
+
+static std::atomic<Scan_Isa> current_scan_isa = supported_scan_isa();
+
+Scan_Isa scan_isa()
+{
+    return current_scan_isa.load(std::memory_order_relaxed);
+}
+
+// Selects a narrower instruction set than the cpu supports, a wider one is ignored
+void set_scan_isa(Scan_Isa isa)
+{
+    current_scan_isa.store(Min(isa, supported_scan_isa()), std::memory_order_relaxed);
+}
+
+static size_t find_blank_end(std::string_view stream, size_t i)
+{
+    switch (scan_isa()) {
+#ifdef QCC_SCAN_X86
+    case Scan_Isa_Avx2:
+        return find_blank_end_avx2(stream.data(), i, stream.size());
+    case Scan_Isa_Sse2:
+        return find_blank_end_sse2(stream.data(), i, stream.size());
+#endif
+    default:
+        return find_blank_end_scalar(stream.data(), i, stream.size());
+    }
+}
+
+static size_t find_any(std::string_view stream, size_t i, char a, char b, char c)
+{
+    switch (scan_isa()) {
+#ifdef QCC_SCAN_X86
+    case Scan_Isa_Avx2:
+        return find_any_avx2(stream.data(), i, stream.size(), a, b, c);
+    case Scan_Isa_Sse2:
+        return find_any_sse2(stream.data(), i, stream.size(), a, b, c);
+#endif
+    default:
+        return find_any_scalar(stream.data(), i, stream.size(), a, b, c);
+    }
+}
+
+// "_+"
+size_t scan_blank(std::string_view stream)
+{
+    size_t n = find_blank_end(stream, 0);
+    return n != 0 ? n : npos;
+}
+
+// "{'//' {{{{'\\'^}|^} ~ /'\n'}? /'\n'}} | {'/*' ^~ '*/'}", an unterminated comment is left to the general
+// matcher
+size_t scan_comment(std::string_view stream)
+{
+    if (stream.size() < 2 or stream[0] != '/')
+        return npos;
+
+    if (stream[1] == '*') {
+        for (size_t i = 2;; i++) {
+            i = find_any(stream, i, '*', '*', '*');
+            if (i + 1 >= stream.size())
+                return npos;
+            if (stream[i + 1] == '/')
+                return i + 2;
+        }
+    }
+
+    if (stream[1] == '/') {
+        for (size_t i = 2;; i += 2) {
+            i = find_any(stream, i, '\n', '\\', '\\');
+            if (i >= stream.size())
+                return npos;
+            if (stream[i] == '\n')
+                return i;
+            if (i + 1 >= stream.size())
+                return npos;
+        }
+    }
+
+    return npos;
+}
+
+static bool is_simple_escape(char c)
+{
+    switch (c) {
+    case '\'':
+    case '"':
+    case '\\':
+    case 'a':
+    case 'b':
+    case 'f':
+    case 'n':
+    case 'r':
+    case 't':
+    case 'v':
+    case '?':
+    case '\n':
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Q {{Escape_Sequence | {!'\n'}} ~ /{Q|'\n'}} Q, numeric escapes and unterminated strings are left to the
+// general matcher
+size_t scan_string(std::string_view stream)
+{
+    if (stream.empty() or stream[0] != '"')
+        return npos;
+
+    for (size_t i = 1;; i += 2) {
+        i = find_any(stream, i, '"', '\\', '\n');
+        if (i >= stream.size() or stream[i] == '\n')
+            return npos;
+        if (stream[i] == '"')
+            return i + 1;
+        if (i + 1 >= stream.size() or !is_simple_escape(stream[i + 1]))
+            return npos;
+    }
+}
+
+// Offset of every line of the source, the first line starts at 0
+void scan_line_starts(std::string_view source, std::vector<uint32> *line_starts)
+{
+    line_starts->push_back(0);
+    for (size_t i = find_any(source, 0, '\n', '\n', '\n'); i < source.size();
+         i = find_any(source, i + 1, '\n', '\n', '\n'))
+        line_starts->push_back(i + 1);
+}
+
+} // namespace qcc
@@ -0,0 +1,31 @@
+#ifndef QCC_KERNEL_HPP
+#define QCC_KERNEL_HPP
+
+#include "common.hpp"
+#include <vector>
+
+namespace qcc
+{
+
+// Specialised matchers for the tokens covering most of the bytes of a source. A kernel returns the length of
+// the token at the start of the stream, or npos when the general matcher must decide
+typedef size_t (*Scan_Kernel)(std::string_view stream);
+
+size_t scan_blank(std::string_view stream);
+size_t scan_comment(std::string_view stream);
+size_t scan_string(std::string_view stream);
+void scan_line_starts(std::string_view source, std::vector<uint32> *line_starts);
+
+enum Scan_Isa : uint8
+{
+    Scan_Isa_Scalar,
+    Scan_Isa_Sse2,
+    Scan_Isa_Avx2,
+};
+
+Scan_Isa scan_isa();
+void set_scan_isa(Scan_Isa isa);
+
+} // namespace qcc
+
+#endif
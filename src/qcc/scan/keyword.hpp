@@ -0,0 +1,82 @@
+#ifndef QCC_KEYWORD_HPP
+#define QCC_KEYWORD_HPP
+
+#include "token.hpp"
+#include <array>
+
+namespace qcc
+{
+
+struct Keyword
+{
+    std::string_view str;
+    Token_Type type;
+};
+
+constexpr Keyword Keywords[] = {
+    {"sizeof", Token_Sizeof},     {"auto", Token_Auto},         {"long", Token_Long},
+    {"short", Token_Short},       {"volatile", Token_Volatile}, {"const", Token_Const},
+    {"extern", Token_Extern},     {"register", Token_Register}, {"restrict", Token_Register},
+    {"static", Token_Static},     {"signed", Token_Signed},     {"unsigned", Token_Unsigned},
+    {"enum", Token_Enum},         {"typedef", Token_Typedef},   {"union", Token_Union},
+    {"struct", Token_Struct},     {"break", Token_Break},       {"case", Token_Case},
+    {"continue", Token_Continue}, {"default", Token_Default},   {"do", Token_Do},
+    {"else", Token_Else},         {"for", Token_For},           {"goto", Token_Goto},
+    {"if", Token_If},             {"return", Token_Return},     {"switch", Token_Switch},
+    {"while", Token_While},       {"void", Token_Void_Type},    {"char", Token_Char_Type},
+    {"int", Token_Int_Type},      {"float", Token_Float_Type},  {"double", Token_Double_Type},
+};
+
+constexpr size_t Keyword_Table_Size = 128;
+
+constexpr uint32 keyword_hash(std::string_view str, uint32 seed)
+{
+    uint32 hash = seed;
+    for (char c : str)
+        hash = (hash ^ (uint8)c) * 16777619;
+    return hash % Keyword_Table_Size;
+}
+
+// Smallest seed for which no two keywords share a slot
+constexpr uint32 keyword_seed()
+{
+    for (uint32 seed = 0;; seed++) {
+        std::array<bool, Keyword_Table_Size> used = {};
+        bool collision = false;
+
+        for (const Keyword &keyword : Keywords) {
+            uint32 slot = keyword_hash(keyword.str, seed);
+            collision = collision or used[slot];
+            used[slot] = true;
+        }
+        if (!collision)
+            return seed;
+    }
+}
+
+constexpr uint32 Keyword_Seed = keyword_seed();
+
+constexpr std::array<int8, Keyword_Table_Size> keyword_table()
+{
+    std::array<int8, Keyword_Table_Size> table = {};
+    table.fill(-1);
+
+    for (size_t n = 0; n < std::size(Keywords); n++)
+        table[keyword_hash(Keywords[n].str, Keyword_Seed)] = n;
+    return table;
+}
+
+constexpr std::array<int8, Keyword_Table_Size> Keyword_Table = keyword_table();
+
+// Classifies an identifier with a perfect hash of the C89 keywords, Token_Id when it is not one of them
+constexpr Token_Type keyword_type(std::string_view str)
+{
+    int8 n = Keyword_Table[keyword_hash(str, Keyword_Seed)];
+    if (n >= 0 and Keywords[n].str == str)
+        return Keywords[n].type;
+    return Token_Id;
+}
+
+} // namespace qcc
+
+#endif
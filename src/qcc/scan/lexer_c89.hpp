@@ -0,0 +1,15 @@
+#ifndef QCC_LEXER_C89_HPP
+#define QCC_LEXER_C89_HPP
+
+#include "regex/dfa.hpp"
+
+namespace qcc
+{
+
+// syntax_map_automaton(syntax_map_c89()) emitted as a switch-based state machine by qcc-lexgen at build time,
+// the pattern of the match is an index of syntax_map_c89()
+regex::Dfa_Match lex_c89(std::string_view stream);
+
+} // namespace qcc
+
+#endif
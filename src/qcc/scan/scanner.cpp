@@ -1,4 +1,6 @@
 #include "scanner.hpp"
+#include "keyword.hpp"
+#include "lexer_c89.hpp"
 
 namespace qcc
 {
@@ -6,33 +8,79 @@ namespace qcc
 Token Scanner::tokenize(Source_Context *context, Syntax_Map syntax_map, int128 skip_mask)
 {
     Token token = {};
+    bool generated = generated_lexer and syntax_map.data() == syntax_map_c89().data();
+    // The generated lexer needs none of the regexes, it outruns the kernels once their dispatch is counted
+    const regex::Dfa *automaton = generated ? NULL : &syntax_map_automaton(syntax_map);
+    const Syntax_Kernels *kernels = generated ? NULL : &syntax_map_kernels(syntax_map);
 
-    if (context->stream.empty()) {
-        token.str = std::string_view{&context->stream.back(), 1};
-        token.type = Token_Eof;
-        token.ok = true;
+    do {
+        if (context->stream.empty()) {
+            token.str = std::string_view{&context->stream.back(), 1};
+            token.type = Token_Eof;
+            token.ok = true;
+            token.context = *context;
+            return token;
+        }
+
+        int32 n = -1;
+        size_t index = npos;
+
+        const Syntax_Kernel *kernel = generated ? NULL : &(*kernels)[(uint8)context->stream.front()];
+        if (generated) {
+            regex::Dfa_Match match = lex_c89(context->stream);
+            n = match.pattern;
+            index = match.index;
+        } else if (kernel->scan != NULL and (index = kernel->scan(context->stream)) != npos) {
+            n = kernel->pattern;
+        } else if (automaton->ok) {
+            regex::Dfa_Match match = automaton->match(context->stream);
+            n = match.pattern;
+            index = match.index;
+        } else {
+            auto [pattern, match] = match_regexes(context->stream, syntax_map);
+            n = pattern;
+            index = match.index;
+        }
+
+        if (n < 0) {
+            token.str = context->stream.substr(0, 1);
+            token.context = *context;
+            throw errorf("unrecognized token", token);
+        }
+
+        token.str = context->stream.substr(0, index);
+        token.type = syntax_map[n].first;
+        if (token.type == Token_Id) {
+            token.type = keyword_type(token.str);
+        }
         token.context = *context;
-	return token;
-    }
+        token.type_str = token_type_str(token.type);
+        context->stream = context->stream.substr(index);
 
-    do {
-        for (const auto &[type, regex] : syntax_map) {
-            if (Regex_Match match = regex.match(context->stream)) {
-                token.str = match.view();
-                token.type = type;
-                token.context = *context;
-                token.type_str = token_type_str(token.type);
-                context->stream = match.next();
-
-                if (!token.type) {
-                    throw errorf("unrecognized token", token);
-                }
-                break;
-            }
+        if (!token.type) {
+            throw errorf("unrecognized token", token);
         }
     } while (token.type & skip_mask);
 
     return token;
 }
 
+std::pair<int32, Regex_Match> Scanner::match_regexes(std::string_view stream, Syntax_Map syntax_map)
+{
+    const Syntax_Buckets &buckets = syntax_map_buckets(syntax_map);
+    token_count++;
+
+    // Only the entries whose regex can start with the first byte are tried, still in the map order
+    for (uint16 n : buckets[(uint8)stream.front()]) {
+        attempt_count++;
+        if (Regex_Match match = syntax_map[n].second.match(stream)) {
+            sequential_attempt_count += n + 1;
+            return {n, match};
+        }
+    }
+
+    sequential_attempt_count += syntax_map.size();
+    return {-1, Regex_Match{stream, npos}};
+}
+
 } // namespace qcc
@@ -9,7 +9,16 @@ namespace qcc
 
 struct Scanner
 {
+    // Regexes tried by match_regexes() through the first byte index, and the count a sequential walk of the
+    // syntax map would have tried
+    size_t token_count = 0;
+    size_t attempt_count = 0;
+    size_t sequential_attempt_count = 0;
+    // lex_c89() stands in for the automaton of syntax_map_c89()
+    bool generated_lexer = true;
+
     Token tokenize(Source_Context *context, Syntax_Map syntax_map, int128 skip_mask = Token_Mask_Skip);
+    std::pair<int32, Regex_Match> match_regexes(std::string_view stream, Syntax_Map syntax_map);
     Token dummy_token(Token_Type type) const;
 
     Error errorf(std::string_view fmt, Token token, auto... args) const
@@ -1,18 +1,23 @@
 #include "syntax_map.hpp"
+#include <map>
+#include <memory>
+#include <mutex>
 
 namespace qcc
 {
 
 Syntax_Map syntax_map_c89()
 {
-    static const std::pair<Token_Type, Regex> c89_map[] = {
+    // Constant-initialized, a pattern is parsed when the interpreted scanner first matches it
+    static constinit const std::pair<Token_Type, Regex> c89_map[] = {
 	{Token_Newline, "'\n'"},
         {Token_Blank, "_+"},
+        {Token_Blank, "'\\' '\n'"},
         {Token_Comment, "  {'//' {{{{'\\'^}|^} ~ /'\n'}? /'\n'}}"
                         "| {'/*' ^~                       '*/'}"},
         {Token_None, "'//'|'/*'"},
 
-#define Hash "'#' ^~ "
+#define Hash "'#' _* "
         {Token_Hash_Include, Hash "'include'"},
         {Token_Hash_Define, Hash "'define'"},
         {Token_Hash_Undef, Hash "'undef'"},
@@ -21,43 +26,10 @@ Syntax_Map syntax_map_c89()
         {Token_Hash_Elif, Hash "'elif'"},
         {Token_Hash_Else, Hash "'else'"},
         {Token_Hash_Endif, Hash "'endif'"},
+        {Token_Hash_Pragma, Hash "'pragma'"},
 #undef Hash
-
-#define Keyword_End "/ !{a|'_'}"
-        {Token_Sizeof, "'sizeof'" Keyword_End},
-        {Token_Auto, "'auto'" Keyword_End},
-        {Token_Long, "'long'" Keyword_End},
-        {Token_Short, "'short'" Keyword_End},
-        {Token_Volatile, "'volatile'" Keyword_End},
-        {Token_Const, "'const'" Keyword_End},
-        {Token_Extern, "'extern'" Keyword_End},
-        {Token_Register, "'register'" Keyword_End},
-        {Token_Register, "'restrict'" Keyword_End},
-        {Token_Static, "'static'" Keyword_End},
-        {Token_Signed, "'signed'" Keyword_End},
-        {Token_Unsigned, "'unsigned'" Keyword_End},
-        {Token_Enum, "'enum'" Keyword_End},
-        {Token_Typedef, "'typedef'" Keyword_End},
-        {Token_Union, "'union'" Keyword_End},
-        {Token_Struct, "'struct'" Keyword_End},
-        {Token_Break, "'break'" Keyword_End},
-        {Token_Case, "'case'" Keyword_End},
-        {Token_Continue, "'continue'" Keyword_End},
-        {Token_Default, "'default'" Keyword_End},
-        {Token_Do, "'do'" Keyword_End},
-        {Token_Else, "'else'" Keyword_End},
-        {Token_For, "'for'" Keyword_End},
-        {Token_Goto, "'goto'" Keyword_End},
-        {Token_If, "'if'" Keyword_End},
-        {Token_Return, "'return'" Keyword_End},
-        {Token_Switch, "'switch'" Keyword_End},
-        {Token_While, "'while'" Keyword_End},
-        {Token_Void_Type, "'void'" Keyword_End},
-        {Token_Char_Type, "'char'" Keyword_End},
-        {Token_Int_Type, "'int'" Keyword_End},
-        {Token_Float_Type, "'float'" Keyword_End},
-        {Token_Double_Type, "'double'" Keyword_End},
-#undef Keyword_End
+        {Token_Hash_Paste, "'##'"},
+        {Token_Hash, "'#'"},
 
 #define Escape_Sequence                                       \
     "{'\\' {q|Q|'\\'|'a'|'b'|'f'|'n'|'r'|'t'|'v'|'?'|'\n'} |" \
@@ -69,6 +41,7 @@ Syntax_Map syntax_map_c89()
         {Token_None, "'L'? {Q | {qq?}} {^~ /'\n'}"},
 #undef Escape_Sequence
 
+        // Keywords are told apart from identifiers by keyword_type()
         {Token_Id, "{a|'_'} {a|'_'|n}*"},
 
         // Todo! Token float hex
@@ -87,6 +60,7 @@ Syntax_Map syntax_map_c89()
         {Token_Int_Hex, "{'0x'|'0X' [0-9]|[a-f]|[A-F]+         } a*"},
         {Token_Int, "    {[0-9]+ {'e'|'E' {'+'|'-'}? [0-9]+ }? } a*"},
 
+        {Token_Ellipsis, "'...'"},
         {Token_Dot, "'.'"},
         {Token_Comma, "','"},
         {Token_Colon, "':'"},
@@ -140,7 +114,7 @@ Syntax_Map syntax_map_c89()
 
 Syntax_Map syntax_map_include()
 {
-    static const std::pair<Token_Type, Regex> include_map[] = {
+    static constinit const std::pair<Token_Type, Regex> include_map[] = {
         {Token_Blank, "_+"},
         {Token_Hash_Cwd_Filepath, "Q ^~ Q"},
         {Token_Hash_System_Filepath, "'<' ^~ '>'"},
@@ -150,4 +124,82 @@ Syntax_Map syntax_map_include()
     return Syntax_Map{include_map};
 }
 
+// Every regex of the map compiled into a single automaton, so a token is found in one pass over the input
+const regex::Dfa &syntax_map_automaton(Syntax_Map syntax_map)
+{
+    static std::map<const void *, std::unique_ptr<regex::Dfa>> automatons = {};
+    static std::mutex mutex = {};
+    std::lock_guard lock{mutex};
+
+    std::unique_ptr<regex::Dfa> &automaton = automatons[syntax_map.data()];
+    if (automaton == NULL) {
+        std::vector<regex::Node *> heads = {};
+        for (const auto &[type, regex] : syntax_map)
+            heads.push_back(regex.compile().head);
+        automaton = std::make_unique<regex::Dfa>(heads);
+    }
+
+    return *automaton;
+}
+
+// Indices of the map entries whose regex can start with a given byte, in the map order
+const Syntax_Buckets &syntax_map_buckets(Syntax_Map syntax_map)
+{
+    static std::map<const void *, std::unique_ptr<Syntax_Buckets>> buckets_cache = {};
+    static std::mutex mutex = {};
+    std::lock_guard lock{mutex};
+
+    std::unique_ptr<Syntax_Buckets> &buckets = buckets_cache[syntax_map.data()];
+    if (buckets == NULL) {
+        buckets = std::make_unique<Syntax_Buckets>();
+        for (size_t n = 0; n < syntax_map.size(); n++) {
+            const Regex &regex = syntax_map[n].second;
+            for (size_t b = 0; b < 256; b++) {
+                if (regex.compile().first[b])
+                    (*buckets)[b].push_back(n);
+            }
+        }
+    }
+
+    return *buckets;
+}
+
+// Kernel of each byte whose first candidate entry has a specialised matcher, a kernel never runs ahead of
+// an entry listed before its own
+const Syntax_Kernels &syntax_map_kernels(Syntax_Map syntax_map)
+{
+    static std::map<const void *, std::unique_ptr<Syntax_Kernels>> kernels_cache = {};
+    static std::mutex mutex = {};
+    const Syntax_Buckets &buckets = syntax_map_buckets(syntax_map);
+    std::lock_guard lock{mutex};
+
+    std::unique_ptr<Syntax_Kernels> &kernels = kernels_cache[syntax_map.data()];
+    if (kernels == NULL) {
+        kernels = std::make_unique<Syntax_Kernels>();
+        for (size_t b = 0; b < 256; b++) {
+            Syntax_Kernel &kernel = (*kernels)[b];
+            kernel = {-1, NULL};
+            if (buckets[b].empty())
+                continue;
+
+            uint16 n = buckets[b].front();
+            switch (syntax_map[n].first) {
+            case Token_Blank:
+                kernel = {n, b != '\\' ? scan_blank : NULL};
+                break;
+            case Token_Comment:
+                kernel = {n, b == '/' ? scan_comment : NULL};
+                break;
+            case Token_String:
+                kernel = {n, b == '"' ? scan_string : NULL};
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    return *kernels;
+}
+
 } // namespace qcc
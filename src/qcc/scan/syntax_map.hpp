@@ -1,16 +1,30 @@
 #ifndef QCC_SYNTAX_MAP_HPP
 #define QCC_SYNTAX_MAP_HPP
 
+#include "kernel.hpp"
 #include "regex.hpp"
 #include "token.hpp"
+#include <array>
 #include <span>
+#include <vector>
 
 namespace qcc
 {
 
 typedef std::span<const std::pair<Token_Type, Regex>> Syntax_Map;
+typedef std::array<std::vector<uint16>, 256> Syntax_Buckets;
+
+struct Syntax_Kernel
+{
+    int32 pattern;
+    Scan_Kernel scan;
+};
+typedef std::array<Syntax_Kernel, 256> Syntax_Kernels;
 Syntax_Map syntax_map_c89();
 Syntax_Map syntax_map_include();
+const regex::Dfa &syntax_map_automaton(Syntax_Map syntax_map);
+const Syntax_Buckets &syntax_map_buckets(Syntax_Map syntax_map);
+const Syntax_Kernels &syntax_map_kernels(Syntax_Map syntax_map);
     
 } // namespace qcc
 
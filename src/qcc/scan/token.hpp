@@ -2,6 +2,8 @@
 #define QCC_TOKEN_HPP
 
 #include "common.hpp"
+#include <array>
+#include <vector>
 
 namespace qcc
 {
@@ -12,8 +14,8 @@ struct Source_Context
 {
     std::string_view source;
     std::string_view stream;
-    struct Token *filepath;
-    int32 line;
+    const struct Token *filepath;
+    const std::vector<uint32> *line_starts;
     int64 hash;
 };
 
@@ -139,7 +141,11 @@ enum Token_Type : int128
 
     Token_Newline = Bit(int128, 101),
     Token_Merged = Bit(int128, 102),
-    Token_Type_End = Bit(int128, 103),
+    Token_Hash_Pragma = Bit(int128, 103),
+    Token_Hash = Bit(int128, 104),
+    Token_Hash_Paste = Bit(int128, 105),
+    Token_Ellipsis = Bit(int128, 106),
+    Token_Type_End = Bit(int128, 107),
 };
 
 const int128 Token_Mask_Each = ~((int128)0);
@@ -178,7 +184,47 @@ const int128 Token_Mask_Bitwise = Token_Bitwise_Not | Token_Bitwise_And | Token_
                                   Token_Bitwise_Xor | Token_Shift_L | Token_Shift_R;
 
 const int128 Token_Mask_Hash = Token_Hash_Include | Token_Hash_Define | Token_Hash_Undef | Token_Hash_Ifdef |
-                               Token_Hash_Ifndef | Token_Hash_Elif | Token_Hash_Else | Token_Hash_Endif;
+                               Token_Hash_Ifndef | Token_Hash_Elif | Token_Hash_Else | Token_Hash_Endif |
+                               Token_Hash_Pragma | Token_Hash;
+
+// Dense index of a token type, the kind of Token_None is 0 and the kind of Bit(int128, n) is n + 1
+typedef uint16 Token_Kind;
+
+constexpr Token_Kind token_kind(Token_Type type)
+{
+    uint64 low = (uint64)type;
+    uint64 high = (uint64)(type >> 64);
+    if (low != 0)
+        return __builtin_ctzll(low) + 1;
+    if (high != 0)
+        return __builtin_ctzll(high) + 65;
+    return 0;
+}
+
+constexpr Token_Kind Token_Kind_Count = token_kind(Token_Type_End);
+
+constexpr std::array<Token_Type, Token_Kind_Count> Token_Kind_Types = [] {
+    std::array<Token_Type, Token_Kind_Count> types = {};
+    for (Token_Kind kind = 1; kind < Token_Kind_Count; kind++)
+        types[kind] = (Token_Type)Bit(int128, kind - 1);
+    return types;
+}();
+
+// Token as stored by the preprocessor, its text and context are recovered through the File_Table
+struct Compact_Token
+{
+    uint32 offset;
+    uint32 size;
+    uint16 file;
+    Token_Kind kind;
+
+    Token_Type type() const
+    {
+        return Token_Kind_Types[kind];
+    }
+};
+
+static_assert(sizeof(Compact_Token) == 12);
 
 static void match_token_contexts(Token *lhs, Token *rhs)
 {
@@ -399,6 +445,14 @@ constexpr std::string_view token_type_str(Token_Type type)
         return "#else";
     case Token_Hash_Endif:
         return "#endif";
+    case Token_Hash_Pragma:
+        return "#pragma";
+    case Token_Hash:
+        return "#";
+    case Token_Hash_Paste:
+        return "##";
+    case Token_Ellipsis:
+        return "...";
     case Token_Hash_Cwd_Filepath:
         return "cwd-filepath";
     case Token_Hash_System_Filepath:
@@ -0,0 +1,143 @@
+#include "token_cache.hpp"
+#include "keyword.hpp"
+#include "syntax_map.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace qcc
+{
+
+constexpr char Token_Cache_Magic[8] = "qcctok1";
+// Bumped whenever the preprocessor changes the tokens it records, the way it reads a directive for one
+constexpr uint64 Token_Cache_Format = 2;
+
+static uint64 hash_bytes(std::string_view bytes, uint64 hash = 0xcbf29ce484222325)
+{
+    for (char c : bytes)
+        hash = (hash ^ (uint8)c) * 0x100000001b3;
+    return hash;
+}
+
+template <typename T>
+static uint64 hash_value(const T &value, uint64 hash)
+{
+    return hash_bytes(std::string_view{(const char *)&value, sizeof(value)}, hash);
+}
+
+// The lexer side of the records: the regexes, the keywords classified outside of the syntax maps, the types
+// behind the kinds and the layout of the tokens. The preprocessor side is the format constant
+uint64 token_cache_version()
+{
+    static const uint64 version = [] {
+        uint64 hash = hash_bytes(Token_Cache_Magic);
+        hash = hash_value(Token_Cache_Format, hash);
+        for (Syntax_Map syntax_map : {syntax_map_c89(), syntax_map_include()}) {
+            for (const auto &[type, regex] : syntax_map) {
+                hash = hash_bytes(regex.src, hash);
+                hash = hash_value(type, hash);
+            }
+        }
+        for (const Keyword &keyword : Keywords) {
+            hash = hash_bytes(keyword.str, hash);
+            hash = hash_value(keyword.type, hash);
+        }
+        hash = hash_value(Token_Kind_Types, hash);
+        hash = hash_value(sizeof(Compact_Token), hash);
+        return hash;
+    }();
+    return version;
+}
+
+bool Token_Cache::enabled() const
+{
+    return !directory.empty();
+}
+
+fs::path Token_Cache::make_filepath(uint64 source_hash) const
+{
+    return directory / fmt::format("{:016x}.tok", source_hash);
+}
+
+bool Token_Cache::load(std::string_view source, Token_Record *record)
+{
+    uint64 source_hash = hash_bytes(source);
+    int fd = ::open(make_filepath(source_hash).c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat status = {};
+
+    if (fd < 0 or fstat(fd, &status) != 0 or (size_t)status.st_size < sizeof(Token_Cache_Header)) {
+        if (fd >= 0)
+            close(fd);
+        miss_count++;
+        return false;
+    }
+
+    size_t size = status.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        miss_count++;
+        return false;
+    }
+
+    Source_Mapping &mapping = mappings.emplace_back();
+    mapping.data = data;
+    mapping.size = size;
+
+    const Token_Cache_Header *header = (const Token_Cache_Header *)data;
+    const Compact_Token *tokens = (const Compact_Token *)(header + 1);
+    bool valid = std::memcmp(header->magic, Token_Cache_Magic, sizeof(Token_Cache_Magic)) == 0 and
+                 header->version == token_cache_version() and header->source_hash == source_hash and
+                 header->source_size == source.size() and header->token_count != 0 and
+                 header->token_count * sizeof(Compact_Token) == size - sizeof(Token_Cache_Header);
+
+    // A stale or colliding file is not trusted, its tokens lie in the source and its record ends at Eof
+    for (size_t n = 0; valid and n < header->token_count; n++) {
+        uint64 end = (uint64)tokens[n].offset + tokens[n].size;
+        valid = tokens[n].kind < Token_Kind_Count and end <= source.size();
+    }
+    if (!valid or tokens[header->token_count - 1].kind != token_kind(Token_Eof)) {
+        mappings.pop_back();
+        miss_count++;
+        return false;
+    }
+
+    record->replay = {tokens, header->token_count};
+    record->next = 0;
+    record->replaying = true;
+    hit_count++;
+    mapped_size += size;
+    return true;
+}
+
+// Written aside then renamed, so a concurrent run never maps a partial file
+void Token_Cache::store(std::string_view source, std::span<const Compact_Token> tokens)
+{
+    Token_Cache_Header header = {};
+    std::memcpy(header.magic, Token_Cache_Magic, sizeof(Token_Cache_Magic));
+    header.version = token_cache_version();
+    header.source_hash = hash_bytes(source);
+    header.source_size = source.size();
+    header.token_count = tokens.size();
+
+    fs::path filepath = make_filepath(header.source_hash);
+    fs::path temporary = filepath;
+    temporary += fmt::format(".{}", getpid());
+
+    std::error_code error = {};
+    fs::create_directories(directory, error);
+    std::ofstream output{temporary, std::ios::binary | std::ios::trunc};
+    output.write((const char *)&header, sizeof(header));
+    output.write((const char *)tokens.data(), tokens.size_bytes());
+    output.close();
+
+    if (output)
+        fs::rename(temporary, filepath, error);
+    else
+        fs::remove(temporary, error);
+}
+
+} // namespace qcc
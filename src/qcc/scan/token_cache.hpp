@@ -0,0 +1,57 @@
+#ifndef QCC_TOKEN_CACHE_HPP
+#define QCC_TOKEN_CACHE_HPP
+
+#include "file_table.hpp"
+#include <span>
+
+namespace qcc
+{
+
+// Kind of the entry standing for a group of a conditional that was skipped untokenized, its offset and size
+// are the byte range of the group
+constexpr Token_Kind Token_Kind_Gap = token_kind(Token_None);
+
+// Tokens of a source in the order the preprocessor reads them, directives and their operands included. Either
+// recorded as the source is scanned or replayed from the token cache, the file of a token is left to 0. A
+// group skipped while recording is a gap, a replay that takes it scans the source up to gap_end
+struct Token_Record
+{
+    std::vector<Compact_Token> tokens;
+    std::span<const Compact_Token> replay;
+    size_t next;
+    size_t gap_end;
+    bool replaying;
+};
+
+// A cache file is this header followed by the tokens, it is mapped as is
+struct Token_Cache_Header
+{
+    char magic[8];
+    uint64 version;
+    uint64 source_hash;
+    uint64 source_size;
+    uint64 token_count;
+};
+
+// Token records of the sources keyed by a hash of their content, under a directory shared by every run. The
+// version stamp changes with the format, the syntax maps, the keywords and the token kinds, a different lexer
+// never replays the cache. The tokens of a file are checked against its source before they are replayed
+struct Token_Cache
+{
+    fs::path directory;
+    std::deque<Source_Mapping> mappings;
+    size_t hit_count = 0;
+    size_t miss_count = 0;
+    size_t mapped_size = 0;
+
+    bool enabled() const;
+    bool load(std::string_view source, Token_Record *record);
+    void store(std::string_view source, std::span<const Compact_Token> tokens);
+    fs::path make_filepath(uint64 source_hash) const;
+};
+
+uint64 token_cache_version();
+
+} // namespace qcc
+
+#endif
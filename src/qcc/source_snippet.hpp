@@ -1,7 +1,7 @@
 #ifndef QCC_SOURCE_SNIPPET_HPP
 #define QCC_SOURCE_SNIPPET_HPP
 
-#include "scan/token.hpp"
+#include "scan/file_table.hpp"
 #include <algorithm>
 
 namespace qcc
@@ -18,6 +18,7 @@ std::string make_source_snippet(Token token, std::string_view fmt, auto... args)
     };
 
     Source_Context context = token.context;
+    Source_Position position = source_position(context, token.str.data());
     std::string_view source = context.source;
     std::string_view str = token.str;
     std::string snippet = "";
@@ -26,11 +27,11 @@ std::string make_source_snippet(Token token, std::string_view fmt, auto... args)
     auto line_begin = Max(token_rbegin.base(), source.begin());
     auto line_end = std::find(str.end(), source.end(), '\n');
     std::string_view line = {line_begin, line_end};
-    uint32 cursor = str.begin() - line_begin + digits_count(context.line);
+    uint32 cursor = str.begin() - line_begin + digits_count(position.line);
 
 #define S std::back_inserter(snippet)
-    fmt::format_to(S, "with ({}:{}) {{\n", context.filepath->str, context.line);
-    fmt::format_to(S, " {} | {}\n", context.line, line);
+    fmt::format_to(S, "with ({}:{}) {{\n", context.filepath->str, position.line);
+    fmt::format_to(S, " {} | {}\n", position.line, line);
     fmt::format_to(S, "    {:>{}}{:^>{}} ", "", cursor, "^", str.size());
     fmt::format_to(S, fmt::runtime(fmt), args...);
     fmt::format_to(S, "\n}}");
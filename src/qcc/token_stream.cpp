@@ -0,0 +1,119 @@
+#include "token_stream.hpp"
+#include "preprocess.hpp"
+
+namespace qcc
+{
+
+// Writes over the oldest tokens read, the history stays in the ring
+void Token_Stream::fill()
+{
+    std::vector<Compact_Token> &tokens = pipe != NULL ? batch : preprocessor.tokens;
+    if (pulled == tokens.size()) {
+        tokens.clear();
+        pulled = 0;
+        bool more = pipe != NULL ? pipe->pop(&batch) : preprocessor.pull();
+        qcc_assert(more, "token stream read past Eof");
+    }
+
+    size_t count = Min(tokens.size() - pulled, Token_Stream_Capacity - Token_Stream_History);
+    for (size_t n = 0; n < count; n++)
+        ring[(end + n) % Token_Stream_Capacity] = tokens[pulled + n];
+    pulled += count;
+    end += count;
+}
+
+Token_Pipe::Token_Pipe(Preprocessor &preprocessor) : preprocessor(preprocessor)
+{
+    producer = std::jthread{[this] { produce(); }};
+}
+
+// The consumer stops the producer and drains the ring, the producer ends the batches at its next push
+Token_Pipe::~Token_Pipe()
+{
+    stopped.store(true, std::memory_order_relaxed);
+    while (!ended) {
+        ended = front().end;
+        release();
+    }
+}
+
+void Token_Pipe::produce()
+{
+    try {
+        preprocessor.open_main();
+        while (!preprocessor.open_sources.empty() and !stopped.load(std::memory_order_relaxed)) {
+            preprocessor.step();
+            if (preprocessor.tokens.size() >= Token_Batch_Size)
+                push(false);
+        }
+    } catch (...) {
+        error = std::current_exception();
+    }
+    push(true);
+}
+
+// Called on the producer, the tokens of the preprocessor are swapped with the ones the consumer gave back
+void Token_Pipe::push(bool end)
+{
+    size_t index = tail.load(std::memory_order_relaxed);
+    for (size_t read; index - (read = head.load(std::memory_order_acquire)) == Token_Pipe_Capacity;) {
+        full_count++;
+        head.wait(read, std::memory_order_acquire);
+    }
+
+    Token_Batch &batch = batches[index % Token_Pipe_Capacity];
+    const std::deque<Source_File> &sources = preprocessor.files.files;
+    batch.tokens.clear();
+    batch.tokens.swap(preprocessor.tokens);
+    batch.sources.clear();
+    if (shared_scratch_file >= 0) {
+        const Source_File &scratch = sources[shared_scratch_file];
+        batch.sources.push_back({(uint32)shared_scratch_file, scratch.source, &scratch});
+    }
+    for (; shared_count < sources.size(); shared_count++)
+        batch.sources.push_back({(uint32)shared_count, sources[shared_count].source, &sources[shared_count]});
+    shared_scratch_file = preprocessor.scratch_file;
+    batch.end = end;
+
+    tail.store(index + 1, std::memory_order_release);
+    tail.notify_one();
+}
+
+// Called on the consumer, false once the batches ended. The error of the producer is thrown then
+bool Token_Pipe::pop(std::vector<Compact_Token> *tokens)
+{
+    while (!ended and tokens->empty()) {
+        Token_Batch &batch = front();
+        for (const Shared_Source &shared : batch.sources) {
+            if (shared.id < files.files.size())
+                files.files[shared.id].source = shared.source;
+            else
+                files.share(*shared.file, shared.source);
+        }
+        tokens->swap(batch.tokens);
+        ended = batch.end;
+        release();
+    }
+
+    if (tokens->empty() and error != NULL)
+        std::rethrow_exception(error);
+    return !tokens->empty();
+}
+
+Token_Batch &Token_Pipe::front()
+{
+    size_t index = head.load(std::memory_order_relaxed);
+    for (size_t written; (written = tail.load(std::memory_order_acquire)) == index;) {
+        empty_count++;
+        tail.wait(written, std::memory_order_acquire);
+    }
+    return batches[index % Token_Pipe_Capacity];
+}
+
+void Token_Pipe::release()
+{
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    head.notify_one();
+}
+
+} // namespace qcc
@@ -0,0 +1,104 @@
+#ifndef QCC_TOKEN_STREAM_HPP
+#define QCC_TOKEN_STREAM_HPP
+
+#include "scan/file_table.hpp"
+#include <array>
+#include <atomic>
+#include <exception>
+#include <thread>
+
+namespace qcc
+{
+
+struct Preprocessor;
+struct Token_Pipe;
+
+constexpr size_t Token_Stream_Capacity = 64;
+constexpr size_t Token_Stream_History = 4;
+constexpr size_t Token_Pipe_Capacity = 16;
+constexpr size_t Token_Batch_Size = 4096;
+
+// Tokens pulled from the preprocessor when the parser reads past the ones it has. The ring keeps the last
+// tokens read so the parser can step back over them, the output of the preprocessor is dropped once pulled.
+// With a pipe the tokens come in batches from the thread running the preprocessor
+struct Token_Stream
+{
+    Preprocessor &preprocessor;
+    Token_Pipe *pipe = NULL;
+    std::array<Compact_Token, Token_Stream_Capacity> ring = {};
+    size_t next = 0;
+    size_t end = 0;
+    std::vector<Compact_Token> batch = {};
+    size_t pulled = 0;
+
+    const Compact_Token &peek()
+    {
+        if (next == end)
+            fill();
+        return ring[next % Token_Stream_Capacity];
+    }
+
+    void advance()
+    {
+        next++;
+    }
+
+    void retreat()
+    {
+        qcc_assert(next > 0 and next - 1 + Token_Stream_Capacity >= end, "token stream history is lost");
+        next--;
+    }
+
+    void fill();
+};
+
+// A source the batch is the first to use, or the scratch source shared by the previous batch which may have
+// grown since. The view is taken when the batch is pushed, the other fields of a source do not change once it
+// is opened
+struct Shared_Source
+{
+    uint32 id;
+    std::string_view source;
+    const Source_File *file;
+};
+
+struct Token_Batch
+{
+    std::vector<Compact_Token> tokens;
+    std::vector<Shared_Source> sources;
+    bool end;
+};
+
+// Single producer single consumer ring of batches, the indices only grow. A side waits on the index of the
+// other when the ring is full or empty. The consumer reads its own table of the sources, made of views into
+// the table of the preprocessor, so the tables are never read and written at the same time. An error of the
+// preprocessor ends the batches and is thrown once the consumer reads past them
+struct Token_Pipe
+{
+    Preprocessor &preprocessor;
+    File_Table files;
+    std::array<Token_Batch, Token_Pipe_Capacity> batches;
+    alignas(64) std::atomic<size_t> head = 0;
+    alignas(64) std::atomic<size_t> tail = 0;
+    std::atomic<bool> stopped = false;
+    std::exception_ptr error = {};
+    bool ended = false;
+    size_t shared_count = 0;
+    int32 shared_scratch_file = -1;
+    size_t full_count = 0;
+    size_t empty_count = 0;
+    std::jthread producer;
+
+    Token_Pipe(Preprocessor &preprocessor);
+    ~Token_Pipe();
+
+    void produce();
+    void push(bool end);
+    bool pop(std::vector<Compact_Token> *tokens);
+    Token_Batch &front();
+    void release();
+};
+
+} // namespace qcc
+
+#endif
@@ -201,6 +201,189 @@ TEST(Regex, Dash)
     EXPECT_EQ("^~/_"_rx.match("words words").view(), "words");
 }
 
+inline testing::AssertionResult match_backtrack(const Regex &regex, std::string_view expr)
+{
+    size_t index = regex.match(expr).index;
+    size_t expected = regex.backtrack(expr).index;
+
+    if (index != expected) {
+        return testing::AssertionFailure()
+               << quoted(regex.src) << " on " << quoted(expr) << ": " << index << " != " << expected;
+    }
+    return testing::AssertionSuccess();
+}
+
+inline testing::AssertionResult match_backtrack_suffixes(const Regex &regex, std::string_view text)
+{
+    for (size_t n = 0; n <= text.size(); n++) {
+        testing::AssertionResult result = match_backtrack(regex, text.substr(n));
+        if (!result)
+            return result;
+    }
+    return testing::AssertionSuccess();
+}
+
+TEST(Regex, Dfa)
+{
+    const char *patterns[] = {
+        "'abc'",
+        "[0-9]+",
+        "{'ab'n}*",
+        "{'a'|'ab'} 'c'",
+        "a{a|'_'|n}*",
+        "^~'c'",
+        "n ~ {'z'|'9'}",
+        "{' '} ~ 'sus'",
+        "'abc' !'d'",
+        "{!'\n'}*",
+        "'abc'/'d'",
+        "^~/_",
+        "{{'a'+}*} 'b'",
+        "{'x'|'xy'}* 'z'",
+        "'' 'a'",
+        "{'a'? 'b'}* 'c'",
+        "a* {'ab'}?",
+        "'L'? {QQ} | {Q {{'\\' ^ | {!'\n'}} ~ /{Q|'\n'}} Q}",
+    };
+
+    std::string text = std::string{LOREM_IPSUM} + "abcd ab1ab2 xyxz \"s\\\"u\" 012345678z aab sus\n";
+
+    for (const char *pattern : patterns) {
+        Regex regex = pattern;
+        Regex_Program &program = regex.compile();
+        program.bit_nfa = Bit_Nfa{};
+        program.dfa = Lazy_Dfa{program.head};
+        EXPECT_TRUE(program.dfa.ok) << pattern;
+        EXPECT_TRUE(match_backtrack_suffixes(regex, text));
+    }
+
+    EXPECT_FALSE("/'ab'"_rx.compile().dfa.ok);
+    EXPECT_TRUE(match_backtrack_suffixes("/'ab' ^"_rx, text));
+}
+
+TEST(Regex, Lazy_Dfa)
+{
+    std::string text = std::string{LOREM_IPSUM} + "abcd ab1ab2 xyxz \"s\\\"u\" 012345678z aab sus\n";
+    Regex regex = "^~ 'sus'";
+    Regex_Program &program = regex.compile();
+    ASSERT_FALSE(program.bit_nfa.ok);
+    EXPECT_EQ(program.dfa.state_count(), 2);
+
+    EXPECT_TRUE(match_backtrack_suffixes(regex, text));
+    EXPECT_GT(program.dfa.state_count(), 2);
+    EXPECT_EQ(program.dfa.flush_count(), 0);
+
+    // Every new cell overflows the budget and flushes the cache
+    program.dfa = Lazy_Dfa{program.head, 0};
+    EXPECT_TRUE(match_backtrack_suffixes(regex, text));
+    EXPECT_GT(program.dfa.flush_count(), 0);
+    EXPECT_LE(program.dfa.state_count(), 3);
+}
+
+TEST(Regex, Bit_Nfa)
+{
+    const std::pair<const char *, bool> patterns[] = {
+        {"'abc'", true},
+        {"[0-9]+", true},
+        {"{'ab'n}*", true},
+        {"a{a|'_'|n}*", true},
+        {"'abc' !'d'", true},
+        {"{!'\n'}*", true},
+        {"'abc'/'d'", true},
+        {"{{'a'+}*} 'b'", true},
+        {"{'x'|'xy'}* 'z'", true},
+        {"a* {'ab'}?", false},
+        {"{'a'|'ab'} 'c'", true},
+        {"'a' | 'ab'", false},
+        {"^~'c'", false},
+        {"n ~ {'z'|'9'}", false},
+        {"^~/_", false},
+        {"'a'* 'ab'?", false},
+    };
+
+    std::string text = std::string{LOREM_IPSUM} + "abcd ab1ab2 xyxz \"s\\\"u\" 012345678z aab sus\n";
+
+    for (auto [pattern, ok] : patterns) {
+        Regex regex = pattern;
+        const Regex_Program &program = regex.compile();
+        EXPECT_EQ(program.bit_nfa.ok, ok) << pattern;
+        EXPECT_NE(program.bit_nfa.ok, program.dfa.ok) << pattern;
+        EXPECT_TRUE(match_backtrack_suffixes(regex, text));
+    }
+
+    std::string long_pattern = "'" + std::string(Bit_Nfa_Positions, 'a') + "'";
+    EXPECT_FALSE(Regex{long_pattern}.compile().bit_nfa.ok);
+}
+
+TEST(Regex, First_Set)
+{
+    EXPECT_EQ("'sizeof'"_rx.compile().first, Char_Set{}.set('s'));
+    EXPECT_EQ("[0-9] | 'x'"_rx.compile().first.count(), 11);
+    EXPECT_EQ("/'a' ^"_rx.compile().first, Char_Set{}.set('a'));
+    EXPECT_EQ("!'a'"_rx.compile().first, ~Char_Set{}.set('a'));
+    EXPECT_TRUE("'a'?"_rx.compile().first.all());
+}
+
+TEST(Regex, Long_Input)
+{
+    constexpr size_t Size = 2 << 20;
+    std::string comment = "/*" + std::string(Size, '*') + " */ int";
+    std::string string = '"' + std::string(Size, 'x') + "\\\"\" int";
+
+    EXPECT_EQ("'/*' ^~ '*/'"_rx.backtrack(comment).index, Size + 5);
+    EXPECT_EQ("Q {{'\\' ^} | ^} ~ Q"_rx.backtrack(string).index, Size + 4);
+}
+
+TEST(Regex, Graph_Layout)
+{
+    // The lookaround sequence is laid out first, then the main graph in id order
+    Regex regex = "{'a' | 'b'}* !{'c' 'd'} 'e'";
+    const Regex_Program &program = regex.compile();
+    ASSERT_EQ(program.graph.nodes.size(), 9);
+    EXPECT_EQ(program.head, &program.graph.nodes[2]);
+
+    Node *const *begin = program.graph.edges.data();
+    Node *const *end = begin + program.graph.edges.size();
+    for (const Node &node : program.graph.nodes) {
+        Node *const *edges = node.edges.data();
+        EXPECT_TRUE(node.edges.empty() or (edges >= begin and edges + node.edges.size() <= end));
+        EXPECT_TRUE(std::is_sorted(node.edges.begin(), node.edges.end(), Node_Cmp{}));
+    }
+
+    const Node &lookaround = program.graph.nodes[7];
+    EXPECT_EQ(lookaround.state.option, Regex_Not);
+    EXPECT_EQ(lookaround.state.sequence, &program.graph.nodes[0]);
+    ASSERT_EQ(lookaround.state.sequence->edges.size(), 1);
+    EXPECT_EQ(lookaround.state.sequence->edges[0], &program.graph.nodes[1]);
+}
+
+TEST(Regex, Long_Pattern)
+{
+    std::string src = "'0:'";
+    for (size_t n = 1; n < 2000; n++)
+        src += fmt::format(" | '{}:'", n);
+
+    Regex regex{src};
+    EXPECT_EQ(regex.match("1999:").index, 5);
+    EXPECT_EQ(regex.match("42:").index, 3);
+    EXPECT_FALSE(regex.match("2000:"));
+
+    std::string nested = std::string(1000, '{') + "'a'+" + std::string(1000, '}');
+    EXPECT_EQ(Regex{nested}.match("aaa").index, 3);
+    EXPECT_THROW(Regex{nested.substr(1)}.compile(), Error);
+}
+
+TEST(Regex, Lazy_Compile)
+{
+    Regex regex = "'abc'";
+    EXPECT_TRUE(regex.program.load() == NULL);
+    EXPECT_TRUE(regex.match("abc"));
+    EXPECT_TRUE(regex.program.load() != NULL);
+
+    EXPECT_EQ(&"'abc'"_rx, &"'abc'"_rx);
+    EXPECT_TRUE("'abc'"_rx.program.load() != NULL);
+}
+
 } // namespace qcc::regex
 
 #endif
@@ -2,25 +2,200 @@
 #define QCC_SCAN_TEST_HPP
 
 #include "preprocess.hpp"
+#include "scan/keyword.hpp"
+#include "scan/lexer_c89.hpp"
+#include "token_stream.hpp"
+#include <cstdlib>
+#include <fstream>
 #include <gtest/gtest.h>
+#include <random>
+
+// The build passes the absolute path of the test sources, the tests then run from any directory
+#ifndef Qcc_Test_Path
+#ifdef QCC_TEST_PATH
+#define Qcc_Test_Path QCC_TEST_PATH
+#else
+#define Qcc_Test_Path "test/"
+#endif
+#endif
 
 namespace qcc
 {
 
+// Files of a test in a directory of their own, the directory is removed when the test ends
+struct Test_Directory
+{
+    fs::path path;
+
+    Test_Directory(std::initializer_list<std::pair<std::string_view, std::string_view>> files = {})
+    {
+        std::string name = (fs::temp_directory_path() / "qcc-test-XXXXXX").string();
+        if (mkdtemp(name.data()) == NULL)
+            throw std::runtime_error{fmt::format("cannot create a test directory: {}", name)};
+        path = name;
+        for (auto [filename, source] : files)
+            write(filename, source);
+    }
+
+    Test_Directory(const Test_Directory &) = delete;
+    Test_Directory &operator=(const Test_Directory &) = delete;
+
+    ~Test_Directory()
+    {
+        std::error_code error = {};
+        fs::remove_all(path, error);
+    }
+
+    void write(std::string_view filename, std::string_view source) const
+    {
+        fs::path filepath = path / filename;
+        fs::create_directories(filepath.parent_path());
+        std::ofstream{filepath} << source;
+    }
+
+    fs::path operator/(std::string_view filename) const
+    {
+        return path / filename;
+    }
+};
+
 TEST(Scan, Syntax_Map_Test)
 {
     EXPECT_NO_THROW(syntax_map_c89());
+    for (const auto &[type, regex] : syntax_map_c89())
+        EXPECT_NO_THROW(regex.compile()) << regex.src;
+}
+
+static const std::string_view Dfa_Source = R"(
+#include <stdio.h>
+#  define  MAX(a, b) ((a) > (b) ? (a) : (b))
+/* block comment */ // line comment \
+continued
+int main(int argc, char **argv) {
+    unsigned long x = 0x1Fu + 0b101 + 1.5e-3f + .5 + 12e3 + 077;
+    char c = '\n', d = L'\'', *s = "str\"ing\\" L"wide";
+    if (x >= 2 && x != 3 || !x) { x <<= 1; x->y; x++; --x; }
+    return sizeof(int) ^ ~x % 2;
+}
+)";
+
+TEST(Scan, Syntax_Map_Dfa)
+{
+    for (Syntax_Map syntax_map : {syntax_map_c89(), syntax_map_include()}) {
+        for (const auto &[type, regex] : syntax_map) {
+            EXPECT_TRUE(regex.compile().bit_nfa.ok or regex.compile().dfa.ok) << regex.src;
+
+            for (size_t n = 0; n < Dfa_Source.size(); n++) {
+                std::string_view expr = Dfa_Source.substr(n);
+                ASSERT_EQ(regex.match(expr).index, regex.backtrack(expr).index) << regex.src << " at " << n;
+            }
+        }
+    }
+}
+
+TEST(Scan, Syntax_Map_Automaton)
+{
+    for (Syntax_Map syntax_map : {syntax_map_c89(), syntax_map_include()}) {
+        const regex::Dfa &automaton = syntax_map_automaton(syntax_map);
+        ASSERT_TRUE(automaton.ok);
+        ASSERT_EQ(&automaton, &syntax_map_automaton(syntax_map));
+
+        for (size_t n = 0; n < Dfa_Source.size(); n++) {
+            std::string_view expr = Dfa_Source.substr(n);
+            regex::Dfa_Match match = automaton.match(expr);
+            int32 pattern = -1;
+            size_t index = npos;
+
+            for (size_t i = 0; i < syntax_map.size(); i++) {
+                if (Regex_Match expected = syntax_map[i].second.match(expr)) {
+                    pattern = i;
+                    index = expected.index;
+                    break;
+                }
+            }
+
+            ASSERT_EQ(match.pattern, pattern) << "at " << n;
+            ASSERT_EQ(match.index, index) << "at " << n;
+        }
+    }
+}
+
+TEST(Scan, First_Byte_Index)
+{
+    for (Syntax_Map syntax_map : {syntax_map_c89(), syntax_map_include()}) {
+        Scanner scanner = {};
+
+        for (size_t n = 0; n < Dfa_Source.size(); n++) {
+            std::string_view expr = Dfa_Source.substr(n);
+            auto [pattern, match] = scanner.match_regexes(expr, syntax_map);
+            int32 expected_pattern = -1;
+            size_t expected_index = npos;
+
+            for (size_t i = 0; i < syntax_map.size(); i++) {
+                if (Regex_Match expected = syntax_map[i].second.match(expr)) {
+                    expected_pattern = i;
+                    expected_index = expected.index;
+                    break;
+                }
+            }
+
+            ASSERT_EQ(pattern, expected_pattern) << "at " << n;
+            ASSERT_EQ(match.index, expected_index) << "at " << n;
+        }
+
+        EXPECT_EQ(scanner.token_count, Dfa_Source.size());
+        EXPECT_LT(scanner.attempt_count, scanner.sequential_attempt_count);
+    }
+}
+
+TEST(Scan, Kernels)
+{
+    std::vector<std::string> sources = {std::string{Dfa_Source}};
+    std::mt19937 random{42};
+    std::string_view alphabet = " \t\v/*\"\\\nax0'";
+
+    for (size_t n = 0; n < 512; n++) {
+        std::string source(random() % 160, ' ');
+        for (char &c : source)
+            c = alphabet[random() % alphabet.size()];
+        sources.push_back(source);
+    }
+
+    for (Scan_Isa isa : {Scan_Isa_Scalar, Scan_Isa_Sse2, Scan_Isa_Avx2}) {
+        set_scan_isa(isa);
+        const regex::Dfa &automaton = syntax_map_automaton(syntax_map_c89());
+        const Syntax_Kernels &kernels = syntax_map_kernels(syntax_map_c89());
+        size_t kernel_count = 0;
+
+        for (std::string_view source : sources) {
+            for (size_t n = 0; n < source.size(); n++) {
+                std::string_view expr = source.substr(n);
+                const Syntax_Kernel &kernel = kernels[(uint8)expr.front()];
+                if (kernel.scan == NULL)
+                    continue;
+
+                size_t index = kernel.scan(expr);
+                if (index == npos)
+                    continue;
+
+                regex::Dfa_Match match = automaton.match(expr);
+                ASSERT_EQ(index, match.index) << "'" << expr << "'";
+                ASSERT_EQ(kernel.pattern, match.pattern) << "'" << expr << "'";
+                kernel_count++;
+            }
+        }
+
+        EXPECT_GT(kernel_count, 0);
+    }
+
+    set_scan_isa(Scan_Isa_Avx2);
 }
 
 static Token Fp_Token = {"test!", Token_Hash_Cwd_Filepath, true};
 
 static void preprocess(Preprocessor &preprocessor, std::string_view source)
 {
-    Source_Context source_context = {};
-    source_context.source = source;
-    source_context.stream = source;
-    source_context.filepath = &Fp_Token;
-    source_context.hash = (int64)&source_context;
+    Source_Context source_context = preprocessor.files.open(std::string{source}, Fp_Token);
     preprocessor.process_context(&source_context, true, Token_Blank);
 }
 
@@ -34,7 +209,7 @@ static testing::AssertionResult match_tokens(std::string_view source_view, std::
 
     for (size_t i = 0; i < expected_tokens.size(); i++) {
         Token expected = expected_tokens[i];
-        Token token = preprocessor.tokens[i];
+        Token token = preprocessor.files.expand(preprocessor.tokens[i]);
 
         if (token.type != expected.type) {
             std::string_view token_type = token_type_str(token.type);
@@ -52,6 +227,608 @@ static testing::AssertionResult match_tokens(std::string_view source_view, std::
 #define Expect_Tokens(source, ...) EXPECT_TRUE(match_tokens(source, {__VA_ARGS__}))
 #define Expect_Scanner_Error(source) EXPECT_THROW(match_tokens(source, {}), Error)
 
+// An unrecognized token ends the stream with a Token_None entry
+static std::vector<std::pair<Token_Type, std::string_view>> scan_tokens(std::string_view source,
+                                                                        bool generated)
+{
+    Scanner scanner = {};
+    scanner.generated_lexer = generated;
+    Source_Context context = {};
+    context.source = source;
+    context.stream = source;
+    context.filepath = &Fp_Token;
+    std::vector<std::pair<Token_Type, std::string_view>> tokens = {};
+
+    try {
+        for (Token token = {}; token.type != Token_Eof;) {
+            token = scanner.tokenize(&context, syntax_map_c89(), 0);
+            tokens.push_back({token.type, token.str});
+        }
+    } catch (Error &) {
+        tokens.push_back({Token_None, context.stream});
+    }
+    return tokens;
+}
+
+TEST(Scan, Generated_Lexer)
+{
+    const regex::Dfa &automaton = syntax_map_automaton(syntax_map_c89());
+    for (size_t n = 0; n < Dfa_Source.size(); n++) {
+        std::string_view expr = Dfa_Source.substr(n);
+        regex::Dfa_Match match = lex_c89(expr);
+        regex::Dfa_Match expected = automaton.match(expr);
+        ASSERT_EQ(match.index, expected.index) << "'" << expr << "'";
+        ASSERT_EQ(match.pattern, expected.pattern) << "'" << expr << "'";
+    }
+
+    std::vector<std::string> sources = {std::string{Dfa_Source}};
+    for (const fs::directory_entry &entry : fs::directory_iterator{Qcc_Test_Path}) {
+        std::ifstream file{entry.path()};
+        sources.push_back(std::string{std::istreambuf_iterator<char>{file}, {}});
+    }
+
+    std::mt19937 random{42};
+    std::string_view alphabet = " \t\n/*\"'\\.0xXeE+-<>=&|ulLfa_#";
+    for (size_t n = 0; n < 512; n++) {
+        std::string source(random() % 80 + 1, ' ');
+        for (char &c : source)
+            c = alphabet[random() % alphabet.size()];
+        sources.push_back(source);
+    }
+
+    for (std::string_view source : sources) {
+        std::vector<std::pair<Token_Type, std::string_view>> tokens = scan_tokens(source, true);
+        std::vector<std::pair<Token_Type, std::string_view>> expected = scan_tokens(source, false);
+
+        ASSERT_EQ(tokens.size(), expected.size()) << "'" << source << "'";
+        for (size_t n = 0; n < tokens.size(); n++) {
+            EXPECT_EQ(tokens[n].first, expected[n].first) << "'" << expected[n].second << "'";
+            EXPECT_EQ(tokens[n].second.data(), expected[n].second.data());
+            EXPECT_EQ(tokens[n].second.size(), expected[n].second.size());
+        }
+    }
+}
+
+TEST(Scan, Compact_Token)
+{
+    for (Token_Kind kind = 0; kind < Token_Kind_Count; kind++)
+        EXPECT_EQ(token_kind(Token_Kind_Types[kind]), kind);
+
+    Preprocessor preprocessor = {"test!"};
+    preprocess(preprocessor, "int x;\n/* c */ x = 'a';\n");
+
+    std::tuple<std::string_view, Token_Type, int32> expected[] = {
+        {"int", Token_Int_Type, 0},
+        {"x", Token_Id, 0},
+        {";", Token_Semicolon, 0},
+        {"/* c */", Token_Comment, 1},
+        {"x", Token_Id, 1},
+        {"=", Token_Assign, 1},
+        {"'a'", Token_Char, 1},
+        {";", Token_Semicolon, 1},
+        {"\n", Token_Eof, 1},
+    };
+    ASSERT_EQ(preprocessor.tokens.size(), std::size(expected));
+
+    for (size_t n = 0; n < preprocessor.tokens.size(); n++) {
+        auto [str, type, line] = expected[n];
+        Token token = preprocessor.files.expand(preprocessor.tokens[n]);
+        EXPECT_EQ(token.str, str);
+        EXPECT_EQ(token.type, type);
+        EXPECT_EQ(source_position(token.context, token.str.data()).line, line);
+        EXPECT_EQ(token.context.filepath->str, "test!");
+        EXPECT_EQ(token.context.stream.data(), token.str.data());
+    }
+}
+
+TEST(Scan, Line_Starts)
+{
+    std::mt19937 random{42};
+    std::string source(4096, ' ');
+    for (char &c : source)
+        c = random() % 8 == 0 ? '\n' : 'x';
+
+    for (Scan_Isa isa : {Scan_Isa_Scalar, Scan_Isa_Sse2, Scan_Isa_Avx2}) {
+        set_scan_isa(isa);
+        File_Table files = {};
+        Source_Context context = files.open(std::string{source}, Fp_Token);
+        Source_Context counted = context;
+        counted.line_starts = NULL;
+
+        for (size_t n = 0; n < source.size(); n++) {
+            Source_Position position = source_position(context, &context.source[n]);
+            Source_Position expected = source_position(counted, &context.source[n]);
+            ASSERT_EQ(position.line, expected.line) << n;
+            ASSERT_EQ(position.column, expected.column) << n;
+        }
+    }
+
+    set_scan_isa(Scan_Isa_Avx2);
+}
+
+TEST(Scan, Mapped_Source)
+{
+    std::vector<fs::path> filepaths = {};
+    for (const fs::directory_entry &entry : fs::directory_iterator{Qcc_Test_Path})
+        filepaths.push_back(entry.path());
+
+    // The padding of an empty file and of a file filling its last page comes from the reserved pages
+    Test_Directory directory = {};
+    for (size_t size : {0, 4096, 8191}) {
+        std::string filename = fmt::format("mapped-{}.c", size);
+        directory.write(filename, std::string(size, 'x'));
+        filepaths.push_back(directory / filename);
+    }
+
+    File_Table files = {};
+    for (const fs::path &filepath : filepaths) {
+        Source_Context context = files.open_file(filepath, Fp_Token);
+        EXPECT_TRUE(files.files.back().mapping.data != NULL) << filepath;
+        EXPECT_EQ(context.source, fstream_to_str(std::fstream{filepath})) << filepath;
+        EXPECT_EQ(context.source.data()[context.source.size()], '\0') << filepath;
+    }
+}
+
+TEST(Preprocess, Include_Guard)
+{
+    std::string_view guarded = "/* c */\n#ifndef A\n# define A 1\n#if B\n#endif\nint a;\n#endif // A\n";
+    Include_Guard guard = detect_include_guard(guarded);
+    EXPECT_EQ(guard.kind, Include_Guard_Macro);
+    EXPECT_EQ(guard.macro, "A");
+    EXPECT_EQ(guarded.substr(guard.body_begin, guard.body_end - guard.body_begin),
+              "# define A 1\n#if B\n#endif\nint a;\n");
+    EXPECT_TRUE(guard.define_in_body);
+
+    // Only an empty object-like define is left out of the body
+    std::string_view empty = "#ifndef A\n#define A /* c */\nint a;\n#endif\n";
+    guard = detect_include_guard(empty);
+    EXPECT_EQ(guard.kind, Include_Guard_Macro);
+    EXPECT_FALSE(guard.define_in_body);
+    EXPECT_EQ(empty.substr(guard.body_begin, guard.body_end - guard.body_begin), "\nint a;\n");
+
+    std::string_view function_like = "#ifndef MIN\n#define MIN(a, b) a\n#endif\n";
+    guard = detect_include_guard(function_like);
+    EXPECT_EQ(guard.kind, Include_Guard_Macro);
+    EXPECT_EQ(function_like.substr(guard.body_begin, guard.body_end - guard.body_begin),
+              "#define MIN(a, b) a\n");
+
+    // '#pragma once' is run by the serial pass, it may stand in an inactive group
+    EXPECT_EQ(detect_include_guard("int a;\n#pragma  once\n").kind, Include_Guard_None);
+    EXPECT_EQ(detect_include_guard("#ifndef A\n#define A\n#else\n#endif\n").kind, Include_Guard_None);
+    EXPECT_EQ(detect_include_guard("#ifndef A\n#define A\n#endif\nint a;\n").kind, Include_Guard_None);
+    EXPECT_EQ(detect_include_guard("#ifndef A\n#define B\n#endif\n").kind, Include_Guard_None);
+    EXPECT_EQ(detect_include_guard("int a;\n#ifndef A\n#define A\n#endif\n").kind, Include_Guard_None);
+}
+
+TEST(Preprocess, Header_Cache)
+{
+    Test_Directory directory = {
+        {"guard.h", "// guard\n#ifndef GUARD_H\n#define GUARD_H\nint g;\n#endif\n"},
+        {"once.h", "#pragma once\nint o;\n"},
+        {"plain.h", "int p;\n"},
+        {"inner.h", "#ifndef INNER_H\n#define INNER_H\nint i;\n#endif\n"},
+        {"nested.h", "#include \"inner.h\"\nint n;\n"},
+        {"value.h", "#ifndef VALUE_H\n#define VALUE_H 1\nint v = VALUE_H;\n#endif\n"},
+        {"min.h", "#ifndef MIN\n#define MIN(a, b) ((a) < (b) ? (a) : (b))\n#endif\n"},
+        {"never.h", "#ifdef NEVER\n#pragma once\n#endif\nint e;\n"},
+        {"main.c", "#include \"guard.h\"\n#include \"guard.h\"\n#include \"once.h\"\n#include \"once.h\"\n"
+                   "#include \"plain.h\"\n#include \"plain.h\"\n"
+                   "#include \"nested.h\"\n#include \"nested.h\"\n"
+                   "#include \"value.h\"\n#include \"value.h\"\n#include \"min.h\"\n#include \"min.h\"\n"
+                   "int m = MIN(1, 2);\n#include \"never.h\"\n#include \"never.h\"\n"},
+    };
+
+    Preprocessor preprocessor = {directory / "main.c"};
+    preprocessor.process();
+
+    std::string str = {};
+    for (Compact_Token token : preprocessor.tokens) {
+        if (token.type() != Token_Eof)
+            str += fmt::format("{}{}", str.empty() ? "" : " ", preprocessor.files.str(token));
+    }
+
+    // nested.h opened a guarded header the first time, it is lexed again. The guards keep their replacement
+    // lists, never.h only holds '#pragma once' in an inactive group
+    EXPECT_EQ(str, "int g ; int o ; int p ; int p ; int i ; int n ; int n ; int v = 1 ; "
+                   "int m = ( ( 1 ) < ( 2 ) ? ( 1 ) : ( 2 ) ) ; int e ; int e ;");
+    EXPECT_EQ(preprocessor.header_reuse_count, 1);
+    EXPECT_EQ(preprocessor.header_skip_count, 5);
+}
+
+TEST(Preprocess, Conditional)
+{
+    // The inactive groups do not lex, they are never tokenized by the serial pass. A directive commented out
+    // in an inactive group is not one, nor a comment quoted in one. The tokens left on a directive line are
+    // dropped
+    Test_Directory directory = {
+        {"cond.h", "#ifdef B\nint hb;\n#else\nint nb;\n#endif\n#ifdef NEVER\n@\n#endif\n"},
+        {"comment.h", "#ifdef NEVER\nchar *p = \"a/*\"; char q = '\"';\n#endif\nint s;\n"
+                      "#ifdef NEVER\n/*\n#endif\n*/ // /*\n#if 0\n#endif\nint z;\n#endif\nint c;\n"},
+        {"dead.h", "#ifdef NEVER\nint never;\n#endif\nint d;\n"},
+        {"main.c", "#define A\n"
+                   "#ifdef A junk\nint a;\n#else junk\nint not_a; @\n#endif junk\n"
+                   "#ifndef B\nint b;\n#ifdef A\nint ab;\n#endif\n"
+                   "#else\n@ '\n#ifdef A\n#else\n#endif\n#endif\n"
+                   "#undef A junk\n"
+                   "#ifndef A\nint no_a;\n#elif A\nint elif;\n#else\nint else_a; @\n#endif\n"
+                   "#include \"cond.h\"\n#define B\n#include \"cond.h\"\n#include \"dead.h\"\n"
+                   "#include \"comment.h\"\n"},
+    };
+
+    size_t hit_count = 0;
+    size_t prefetched_count = 0;
+    auto preprocess = [&](size_t thread_count, bool cached) {
+        Preprocessor preprocessor = {directory / "main.c"};
+        preprocessor.thread_count = thread_count;
+        preprocessor.token_cache.directory = cached ? directory / "cache" : "";
+        preprocessor.process();
+        hit_count = preprocessor.token_cache.hit_count;
+        prefetched_count = preprocessor.prefetched.size();
+
+        std::string ids = {};
+        for (Compact_Token token : preprocessor.tokens) {
+            if (token.type() == Token_Id)
+                ids += fmt::format("{} ", preprocessor.files.expand(token).str);
+        }
+        return ids;
+    };
+
+    std::string_view expected = "a b ab no_a nb hb d s c ";
+    EXPECT_EQ(preprocess(1, false), expected);
+
+    // The lexers leave each group to a gap, the '@' they would fail on are never read. cond.h is replayed
+    // with B undefined then defined, each time scanning the group it takes
+    EXPECT_EQ(preprocess(4, false), expected);
+    EXPECT_EQ(prefetched_count, 3);
+    EXPECT_EQ(preprocess(4, true), expected);
+    EXPECT_EQ(preprocess(1, true), expected);
+    EXPECT_EQ(hit_count, 4);
+
+    directory.write("main.c", "#ifdef A\nint a;\n");
+    EXPECT_THROW(preprocess(1, false), Error);
+    directory.write("main.c", "#endif\n");
+    EXPECT_THROW(preprocess(1, false), Error);
+    directory.write("main.c", "#ifdef A\nint a;\n#elif B\nint b;\n#endif\n");
+    EXPECT_THROW(preprocess(1, false), Error);
+}
+
+TEST(Preprocess, Token_Cache)
+{
+    Test_Directory directory = {
+        {"guard.h", "#ifndef GUARD_H\n#define GUARD_H\n#pragma pack\nint g;\n#endif\n"},
+        {"plain.h", "#include \"guard.h\"\nint p; /* plain */\n"},
+        {"main.c", "#include \"plain.h\"\nint main() { return 0; }\n"},
+    };
+
+    // The sources are unmapped with the preprocessor, the tokens are copied out
+    auto preprocess = [&](std::vector<std::pair<std::string, Token_Type>> *tokens) {
+        Preprocessor preprocessor = {directory / "main.c"};
+        preprocessor.token_cache.directory = directory / "cache";
+        preprocessor.process();
+        for (Compact_Token token : preprocessor.tokens)
+            tokens->emplace_back(preprocessor.files.expand(token).str, token.type());
+        return std::pair{preprocessor.token_cache.hit_count, preprocessor.token_cache.miss_count};
+    };
+
+    std::vector<std::pair<std::string, Token_Type>> cold = {}, warm = {}, edited = {};
+    EXPECT_EQ(preprocess(&cold), std::pair(0ul, 2ul));
+    EXPECT_EQ(preprocess(&warm), std::pair(2ul, 0ul));
+
+    EXPECT_EQ(cold, warm);
+
+    // A file whose tokens do not fit its source misses and is written again
+    auto corrupt = [&](auto edit) {
+        for (const fs::directory_entry &entry : fs::directory_iterator{directory / "cache"}) {
+            std::ifstream input{entry.path(), std::ios::binary};
+            std::string bytes = {std::istreambuf_iterator(input), {}};
+            Compact_Token *tokens = (Compact_Token *)(bytes.data() + sizeof(Token_Cache_Header));
+            edit(tokens, (bytes.size() - sizeof(Token_Cache_Header)) / sizeof(Compact_Token));
+            std::ofstream{entry.path(), std::ios::binary} << bytes;
+        }
+    };
+    auto expect_miss = [&] {
+        std::vector<std::pair<std::string, Token_Type>> tokens = {};
+        EXPECT_EQ(preprocess(&tokens), std::pair(0ul, 2ul));
+        EXPECT_EQ(tokens, cold);
+    };
+
+    corrupt([](Compact_Token *tokens, size_t count) { tokens[0].kind = Token_Kind_Count; });
+    expect_miss();
+    corrupt([](Compact_Token *tokens, size_t count) { tokens[count / 2].offset = UINT32_MAX - 1; });
+    expect_miss();
+    corrupt([](Compact_Token *tokens, size_t count) { tokens[count - 1].kind = token_kind(Token_Id); });
+    expect_miss();
+
+    // An edited header misses, the other one is still replayed
+    directory.write("plain.h", "#include \"guard.h\"\nint q;\n");
+    EXPECT_EQ(preprocess(&edited), std::pair(1ul, 1ul));
+}
+
+TEST(Preprocess, Parallel_Include)
+{
+    Test_Directory directory = {};
+
+    std::string main_source = {};
+    for (int32 n = 0; n < 16; n++) {
+        std::string name = fmt::format("h{}.h", n);
+        std::string source = fmt::format("#ifndef H{0}\n#define H{0}\n"
+                                         "#include \"h{1}.h\"\nint h{0};\n#endif\n",
+                                         n, (n + 1) % 16);
+        directory.write(name, source);
+        main_source += fmt::format("#include \"{}\"\nint m{};\n", name, n);
+    }
+    directory.write("once.h", "#pragma once\nint o;\n");
+    directory.write("main.c", main_source + "#include \"once.h\"\n#include \"once.h\"\n");
+
+    typedef std::vector<std::tuple<uint32, uint32, uint16, Token_Kind>> Compact_Tokens;
+    auto preprocess = [&](size_t thread_count, Compact_Tokens *tokens) {
+        Preprocessor preprocessor = {directory / "main.c"};
+        preprocessor.thread_count = thread_count;
+        preprocessor.process();
+        for (Compact_Token token : preprocessor.tokens)
+            tokens->emplace_back(token.offset, token.size, token.file, token.kind);
+
+        // h0.h is included back by h15.h while it is still open, it is neither listed nor mapped again
+        EXPECT_EQ(preprocessor.dependencies.size(), 18);
+        EXPECT_EQ(preprocessor.files.files.size(), 18);
+        return preprocessor.prefetched.size();
+    };
+
+    Compact_Tokens serial = {}, parallel = {};
+    EXPECT_EQ(preprocess(1, &serial), 0);
+    EXPECT_EQ(preprocess(4, &parallel), 17);
+    EXPECT_EQ(serial, parallel);
+}
+
+TEST(Preprocess, Chunked_Lexing)
+{
+    Test_Directory directory = {};
+
+    std::string source = "#include \"header.h\"\n/*\n";
+    for (int32 n = 0; n < 64; n++)
+        source += fmt::format("int commented{0}; \"\n#define C{0}\n", n);
+    source += "*/\n";
+    for (int32 n = 0; n < 64; n++) {
+        source += fmt::format("int a{0} = {0}; // line {0} \"\n", n);
+        source += fmt::format("char *s{0} = \"{0}\\\n/* {0}\";\n#pragma {0} /* */\n", n);
+    }
+
+    // The chunks are split inside groups, the groups are gaps of their records
+    source += "#define D0\n#define D2\n";
+    for (int32 n = 0; n < 32; n++)
+        source += fmt::format("#ifdef D{0}\nint t{1};\n#ifndef D1\nint u{1};\n#endif\n"
+                              "#else\nint e{1};\n#endif\n",
+                              n % 3, n);
+    directory.write("main.c", source);
+    directory.write("header.h", "int h;\n");
+
+    typedef std::vector<std::pair<std::string, Token_Type>> Tokens;
+    auto preprocess = [&](size_t thread_count, Tokens *tokens) {
+        Preprocessor preprocessor = {directory / "main.c"};
+        preprocessor.thread_count = thread_count;
+        preprocessor.chunk_size = 64;
+        preprocessor.process();
+        for (Compact_Token token : preprocessor.tokens)
+            tokens->emplace_back(preprocessor.files.expand(token).str, token.type());
+        return preprocessor.chunk_relex_count;
+    };
+
+    Tokens serial = {}, chunked = {};
+    EXPECT_EQ(preprocess(1, &serial), 0);
+    EXPECT_GT(preprocess(4, &chunked), 0);
+    EXPECT_EQ(serial, chunked);
+}
+
+TEST(Preprocess, Include_Resolution)
+{
+    Test_Directory directory = {
+        {"b.h", "int top_b;\n"},
+        {"sub/a.h", "#include \"b.h\"\n#include \"../b.h\"\n#include <x.h>\n"},
+        {"sub/b.h", "int sub_b;\n"},
+        {"inc1/x.h", "int inc1_x;\n#include <sys/y.h>\n"},
+        {"inc2/x.h", "int inc2_x;\n"},
+        {"inc2/sys/y.h", "int inc2_y;\n"},
+        {"main.c", "#include \"sub/a.h\"\n#include \"sub/a.h\"\n#include \"b.h\"\n"},
+    };
+
+    // A '""' include is looked up next to the including file first, the -I directories are searched in order
+    auto preprocess = [&](bool listed, size_t thread_count, std::pair<size_t, size_t> *counts) {
+        Preprocessor preprocessor = {directory / "main.c"};
+        preprocessor.include_directories = {directory / "inc1", directory / "inc2"};
+        preprocessor.list_include_directories = listed;
+        preprocessor.thread_count = thread_count;
+        preprocessor.process();
+        *counts = {preprocessor.include_cache_hit_count, preprocessor.include_probe_count};
+
+        std::string ids = {};
+        for (Compact_Token token : preprocessor.tokens) {
+            if (token.type() == Token_Id)
+                ids += fmt::format("{} ", preprocessor.files.str(token));
+        }
+        return ids;
+    };
+
+    std::string_view expected = "sub_b top_b inc1_x inc2_y sub_b top_b inc1_x inc2_y top_b ";
+    std::pair<size_t, size_t> counts = {}, listed_counts = {}, parallel_counts = {};
+    EXPECT_EQ(preprocess(false, 1, &counts), expected);
+    EXPECT_EQ(preprocess(true, 1, &listed_counts), expected);
+    EXPECT_EQ(preprocess(false, 4, &parallel_counts), expected);
+
+    // The second 'sub/a.h' is resolved from the cache. Its tokens are reused, its own includes are not
+    // resolved again. A listed directory only stats the files it holds, 'inc1/sys/y.h' is not one of them
+    EXPECT_EQ(counts, std::pair(1ul, 7ul));
+    EXPECT_EQ(listed_counts, std::pair(1ul, 6ul));
+    // The pre-scan of the main file resolved its includes ahead of the serial pass
+    EXPECT_EQ(parallel_counts.first, 4);
+
+    directory.write("main.c", "#include <missing.h>\n");
+    EXPECT_THROW(preprocess(true, 1, &counts), Error);
+}
+
+TEST(Preprocess, Macro)
+{
+    Test_Directory directory = {};
+    directory.write("macros.h", "#define TABLE(X) X(red) X(green) \\\n X(blue)\n"
+                                "#define NAME(n) #n,\n#define ENUM(n) n,\n");
+    directory.write("plain.h", "int X;\n");
+
+    auto preprocess = [&](std::string_view source, size_t thread_count = 1) {
+        directory.write("main.c", source);
+        Preprocessor preprocessor = {directory / "main.c"};
+        preprocessor.thread_count = thread_count;
+        preprocessor.process();
+
+        std::string str = {};
+        for (Compact_Token token : preprocessor.tokens) {
+            if (token.type() != Token_Eof)
+                str += fmt::format("{}{}", str.empty() ? "" : " ", preprocessor.files.str(token));
+        }
+        return str;
+    };
+
+    EXPECT_EQ(preprocess("#define N 42\nint a = N;\n"), "int a = 42 ;");
+    EXPECT_EQ(preprocess("#define MAX(a, b) ((a) > (b) ? (a) : (b))\nMAX(x, f(y, 1))\n"),
+              "( ( x ) > ( f ( y , 1 ) ) ? ( x ) : ( f ( y , 1 ) ) )");
+    EXPECT_EQ(preprocess("#define F(x) x\nint F; F\n(1)\n"), "int F ; 1");
+    EXPECT_EQ(preprocess("#define const\n#define L a \\\n b\nconst int L;\n"), "int a b ;");
+    EXPECT_EQ(preprocess("#define U 1\n#undef U\nU\n"), "U");
+
+    // A macro does not expand in its own expansion, the hidesets follow the example of the standard
+    EXPECT_EQ(preprocess("#define foo foo a\nfoo\n"), "foo a");
+    EXPECT_EQ(preprocess("#define f(a) a*g\n#define g(a) f(a)\nf(2)(9)\n"), "2 * 9 * g");
+
+    EXPECT_EQ(preprocess("#define S(x) #x\n#define XS(x) S(x)\n#define ONE 1\nS(ONE) XS(ONE)\n"),
+              "\"ONE\" \"1\"");
+    EXPECT_EQ(preprocess("#define S(x) #x\nS( a  \"b\\n\"  'c' )\n"), "\"a \\\"b\\\\n\\\" 'c'\"");
+    EXPECT_EQ(preprocess("#define CAT(a, b) a ## b\nCAT(x, 1) CAT(, y) CAT(-, >) CAT(a b, c d)\n"),
+              "x1 y -> a bc d");
+    EXPECT_EQ(preprocess("#define V(f, ...) f(__VA_ARGS__)\nV(g, 1, (2, 3)) V(h)\n"),
+              "g ( 1 , ( 2 , 3 ) ) h ( )");
+
+    // The replacement lists of the header stay in its source, the header is only copied again while no macro
+    // changed
+    std::string_view tables = "#include \"macros.h\"\nenum { TABLE(ENUM) };\nchar *s[] = { TABLE(NAME) };\n";
+    std::string_view expected =
+        "enum { red , green , blue , } ; char * s [ ] = { \"red\" , \"green\" , \"blue\" , } ;";
+    EXPECT_EQ(preprocess(tables), expected);
+    EXPECT_EQ(preprocess(tables, 4), expected);
+    EXPECT_EQ(preprocess("#include \"plain.h\"\n#define X y\n#include \"plain.h\"\n"), "int X ; int y ;");
+
+    EXPECT_THROW(preprocess("#define F(x) x\nF(1\n"), Error);
+    EXPECT_THROW(preprocess("#define F(x) x\nF(1, 2)\n"), Error);
+    EXPECT_THROW(preprocess("#define F(x) #y\n"), Error);
+    EXPECT_THROW(preprocess("#define F(x, x\n"), Error);
+    EXPECT_THROW(preprocess("#define CAT(a, b) a ## b\nCAT(+, /)\n"), Error);
+    EXPECT_THROW(preprocess("#define 1\n"), Error);
+}
+
+TEST(Preprocess, Token_Stream)
+{
+    Test_Directory directory = {};
+
+    std::string main = "#define PAIR(a, b) a b\n#include \"plain.h\"\n";
+    for (size_t n = 0; n < 1000; n++)
+        main += fmt::format("int x{} = PAIR(n, {});\n#include \"plain.h\"\n", n, n);
+    directory.write("main.c", main);
+    directory.write("plain.h", "int p;\n");
+
+    Preprocessor processed = {directory / "main.c"};
+    processed.thread_count = 1;
+    processed.process();
+
+    // The output is pulled a step at a time and dropped once in the ring, it never holds the whole file
+    Preprocessor streamed = {directory / "main.c"};
+    streamed.thread_count = 1;
+    streamed.open_main();
+    Token_Stream stream = {streamed};
+    size_t max_pending = 0;
+    for (size_t n = 0; n + 1 < processed.tokens.size(); n++) {
+        Compact_Token token = stream.peek();
+        max_pending = Max(max_pending, streamed.tokens.size());
+        ASSERT_EQ(streamed.files.str(token), processed.files.str(processed.tokens[n]));
+        ASSERT_EQ(token.type(), processed.tokens[n].type());
+        stream.advance();
+        if (n % 7 == 0) {
+            stream.retreat();
+            ASSERT_EQ(streamed.files.str(stream.peek()), processed.files.str(processed.tokens[n]));
+            stream.advance();
+        }
+    }
+
+    EXPECT_EQ(stream.peek().type(), Token_Eof);
+    EXPECT_EQ(streamed.header_reuse_count, processed.header_reuse_count);
+    EXPECT_LT(max_pending, 16);
+}
+
+TEST(Preprocess, Token_Pipe)
+{
+    Test_Directory directory = {};
+
+    std::string main = "#define PAIR(a, b) a ## b ## _pasted_into_a_scratch_source\n";
+    for (size_t n = 0; n < 10000; n++)
+        main += fmt::format("int x{} = PAIR(n, {});\n#include \"plain.h\"\n", n, n);
+    directory.write("main.c", main);
+    directory.write("plain.h", "int p;\n");
+
+    Preprocessor processed = {directory / "main.c"};
+    processed.process();
+
+    // The parser side reads its own table of the sources, the ids of the tokens are the same. The pasted
+    // tokens fill several scratch sources, which grow while the batches are read
+    {
+        Preprocessor piped = {directory / "main.c"};
+        Token_Pipe pipe = {piped};
+        Token_Stream stream = {piped, &pipe};
+        for (size_t n = 0; n < processed.tokens.size(); n++, stream.advance()) {
+            Compact_Token token = stream.peek();
+            ASSERT_EQ(pipe.files.expand(token).str, processed.files.str(processed.tokens[n]));
+            ASSERT_EQ(token.type(), processed.tokens[n].type());
+        }
+        EXPECT_EQ(pipe.files.files.size(), processed.files.files.size());
+    }
+
+    // The consumer may stop early, the producer ends at its next batch
+    {
+        Preprocessor piped = {directory / "main.c"};
+        Token_Pipe pipe = {piped};
+        Token_Stream stream = {piped, &pipe};
+        EXPECT_EQ(pipe.files.str(stream.peek()), "int");
+    }
+
+    // The error of the preprocessor is thrown once the tokens before it are read
+    directory.write("main.c", "int a;\n#include \"missing.h\"\n");
+    Preprocessor piped = {directory / "main.c"};
+    Token_Pipe pipe = {piped};
+    Token_Stream stream = {piped, &pipe};
+    EXPECT_EQ(pipe.files.str(stream.peek()), "int");
+    stream.advance();
+    stream.advance();
+    stream.advance();
+    EXPECT_THROW(stream.peek(), Error);
+}
+
+TEST(Preprocess, Dependencies)
+{
+    Test_Directory directory = {
+        {"guard.h", "#ifndef GUARD_H\n#define GUARD_H\nint g;\n#endif\n"},
+        {"plain.h", "int p;\n"},
+        {"nested $#.h", "#include \"guard.h\"\n#include \"plain.h\"\n"},
+        {"a.h", "#ifndef A_H\n#define A_H\n#include \"b.h\"\n#endif\n"},
+        {"b.h", "#ifndef B_H\n#define B_H\n#include \"a.h\"\n#endif\n"},
+        {"main.c", "#include \"plain.h\"\n#include \"guard.h\"\n#include \"plain.h\"\n"
+                   "#include \"nested $#.h\"\n#include \"guard.h\"\n#include \"a.h\"\n"},
+    };
+
+    // A header is listed once whether it is lexed again, reused or skipped, even while it is still open
+    Preprocessor preprocessor = {directory / "main.c"};
+    preprocessor.process();
+    std::string d = directory.path.string();
+    EXPECT_EQ(preprocessor.dependency_rule("out file"),
+              fmt::format("out\\ file: \\\n  {0}/main.c \\\n  {0}/plain.h \\\n  {0}/guard.h \\\n"
+                          "  {0}/nested\\ $$\\#.h \\\n  {0}/a.h \\\n  {0}/b.h\n",
+                          d));
+}
+
 TEST(Scanner, Comment)
 {
     Expect_Tokens("// Hello World \n", {"// Hello World ", Token_Comment});
@@ -206,6 +983,17 @@ TEST(Lexer, Keyword)
 
     Expect_Tokens("        signed", {"signed", Token_Signed});
     Expect_Tokens("signed        ", {"signed", Token_Signed});
+
+    Expect_Tokens("restrict", {"restrict", Token_Register});
+    Expect_Tokens("int2", {"int2", Token_Id});
+    Expect_Tokens("do_while", {"do_while", Token_Id});
+    Expect_Tokens("iff", {"iff", Token_Id});
+    Expect_Tokens("Int", {"Int", Token_Id});
+
+    for (const Keyword &keyword : Keywords)
+        EXPECT_EQ(keyword_type(keyword.str), keyword.type) << keyword.str;
+    static_assert(keyword_type("sizeof") == Token_Sizeof);
+    static_assert(keyword_type("sizeo") == Token_Id);
 }
 
 TEST(Lexer, Operator)
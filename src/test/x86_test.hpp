@@ -50,8 +50,9 @@ static testing::AssertionResult expect_return(std::string_view file, int expecte
 
     Ast ast = {};
     Preprocessor preprocessor = {filepath.string()};
-    preprocessor.process();
-    Parser parser = {ast, &preprocessor.tokens[0], false};
+    preprocessor.open_main();
+    Token_Stream token_stream = {preprocessor};
+    Parser parser = {ast, preprocessor.files, token_stream, false};
     parser.parse();
     Allocator allocator = {ast, 7, 7};
     allocator.allocate();